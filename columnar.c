@@ -0,0 +1,778 @@
+/* Arrow IPC and Parquet output, written by hand so nothing has to be
+ * linked in.  <dir>/waypoints, tracks and device tables, every column
+ * required (no nulls); rows are kept in memory per column until a row
+ * group (s->rowgroup rows, default COL_ROWGROUP) is full. */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gr260int.h"
+
+#define COL_ROWGROUP 65536
+#define PAD8(n) (((n)+7) & ~(size_t)7)
+
+enum coltype { COL_U8, COL_U16, COL_U32, COL_U64, COL_TIME, COL_F32, COL_STR };
+
+static const unsigned colSize[] = { 1, 2, 4, 8, 8, 4, 0 };
+
+struct colspec {
+	const char* name;
+	enum coltype type;
+};
+
+static const struct colspec wpCols[] = { /* raw records, time as unix time */
+	{ "track", COL_U32 }, { "time", COL_TIME }, { "lat", COL_F32 },
+	{ "lon", COL_F32 }, { "altgps", COL_U16 }, { "speed", COL_U16 },
+	{ "unk1", COL_U8 }, { "unk2", COL_U8 }, { "is_poi", COL_U8 },
+	{ "hbr", COL_U16 }, { "altbar", COL_U16 }, { "heading", COL_U16 },
+	{ "dist", COL_U32 }, { "unk7", COL_U32 },
+	{ "device", COL_STR }, /* merged streams only */
+};
+
+static const struct colspec trackCols[] = {
+	{ "num", COL_U32 }, { "unk0", COL_U32 }, { "name", COL_STR },
+	{ "time", COL_TIME }, { "duration", COL_U32 }, { "length", COL_U32 },
+	{ "start_addr", COL_U32 }, { "size", COL_U32 }, { "unk1", COL_U16 },
+	{ "unk2", COL_U16 }, { "unk3", COL_U16 }, { "unk4", COL_U16 },
+	{ "unk5", COL_U32 }, { "unk6", COL_U32 }, { "unk7", COL_U32 },
+	{ "unk8", COL_U32 }, { "unk9", COL_U32 },
+};
+
+static const struct colspec deviceCols[] = {
+	{ "model", COL_STR }, { "firmware", COL_U32 }, /* as in $PHLX861 */
+	{ "tracks", COL_U32 }, { "waypoints", COL_U64 }, { "first", COL_TIME },
+	{ "last", COL_TIME },
+};
+
+#define NCOLS(spec) (sizeof(spec)/sizeof(spec[0]))
+
+union colval {
+	uint64_t u;
+	float f;
+	const char* s;
+};
+
+struct buf {
+	char* p;
+	size_t len, cap;
+};
+
+struct table {
+	const struct colspec* spec;
+	const struct colformat* fmt;
+	unsigned ncols;
+	unsigned rows, maxrows; /* pending, per group */
+	uint64_t total;
+	struct buf* data; /* per column, values of the pending rows */
+	struct buf* offs; /* per string column, uint32_t offsets into data */
+	struct buf groups; /* uint64_t per written group, for the footer */
+	char* path;
+	FILE* f;
+	int failed;
+};
+
+struct colformat {
+	const char* fmt;
+	const char* ext;
+	void (*begin)(struct table* t);
+	void (*group)(struct table* t);
+	void (*end)(struct table* t);
+};
+
+static void bufPut(struct buf* const b, const void* p, const size_t n) {
+	if (!n) {
+		return;
+	}
+	if (b->len+n > b->cap) {
+		b->cap = 2*b->cap > b->len+n ? 2*b->cap : b->len+n+4096;
+		b->p = realloc(b->p,b->cap);
+	}
+	memcpy(b->p+b->len,p,n);
+	b->len += n;
+}
+
+static void bufU64(struct buf* const b, const uint64_t v) {
+	bufPut(b,&v,sizeof(v));
+}
+
+/* contents padded to 8 bytes */
+static void bufWrite(const struct buf* const b, FILE* f) {
+	static const char zero[8];
+
+	if (b->len) {
+		fwrite(b->p,1,b->len,f);
+		fwrite(zero,1,PAD8(b->len)-b->len,f);
+	}
+}
+
+/*** Arrow IPC file format ***/
+
+/* flatbuffer built back to front: the data is the last len bytes of buf
+ * and objects are referred to by their distance from the end */
+struct fbb {
+	uint8_t* buf;
+	size_t cap, len;
+};
+
+struct fbfield { /* table field, ref: v is an object, stored as uoffset */
+	uint8_t id, size, ref;
+	uint64_t v;
+};
+
+#define FB_VAL(id,size,v) { id, size, 0, v }
+#define FB_REF(id,obj) { id, 4, 1, obj }
+
+static uint32_t fbPush(struct fbb* const b, const void* p, const size_t n) {
+	if (!n) {
+		return b->len;
+	}
+	if (b->len+n > b->cap) {
+		const size_t cap = 2*b->cap > b->len+n ? 2*b->cap : b->len+n+1024;
+		uint8_t* const nbuf = malloc(cap);
+
+		if (b->len)
+			memcpy(nbuf+cap-b->len,b->buf+b->cap-b->len,b->len);
+		free(b->buf);
+		b->buf = nbuf;
+		b->cap = cap;
+	}
+	b->len += n;
+	if (p) {
+		memcpy(b->buf+b->cap-b->len,p,n);
+	} else {
+		memset(b->buf+b->cap-b->len,0,n);
+	}
+	return b->len;
+}
+
+/* pads so that pushing extra more bytes ends aligned */
+static void fbAlign(struct fbb* const b, const size_t align, const size_t extra) {
+	fbPush(b,NULL,(align-(b->len+extra)%align)%align);
+}
+
+static uint32_t fbString(struct fbb* const b, const char s[]) {
+	const uint32_t n = strlen(s);
+
+	fbAlign(b,4,n+1);
+	fbPush(b,NULL,1);
+	fbPush(b,s,n);
+	return fbPush(b,&n,4);
+}
+
+static uint32_t fbStructs(struct fbb* const b, const void* p, const uint32_t n,
+			  const size_t size) {
+	fbAlign(b,8,n*size);
+	fbPush(b,p,n*size);
+	return fbPush(b,&n,4);
+}
+
+static uint32_t fbRefs(struct fbb* const b, const uint32_t obj[], const uint32_t n) {
+	uint32_t i;
+
+	fbAlign(b,4,0);
+	for (i = n; i--; ) {
+		const uint32_t o = b->len+4-obj[i];
+
+		fbPush(b,&o,4);
+	}
+	return fbPush(b,&n,4);
+}
+
+/* fields largest first so each is aligned, then the table and its vtable */
+static uint32_t fbTable(struct fbb* const b, const struct fbfield f[], const unsigned n) {
+	uint32_t pos[16] = { 0 };
+	uint16_t vt[2+16];
+	unsigned i, size, nids = 0;
+	uint32_t start, tbl;
+	int32_t soff;
+
+	fbAlign(b,4,0);
+	start = b->len;
+	for (size = 8; size; size /= 2) {
+		for (i = 0; i < n; i++) {
+			if (f[i].size != size)
+				continue;
+			fbAlign(b,size,0);
+			if (f[i].ref) {
+				const uint32_t o = b->len+4-f[i].v;
+
+				pos[f[i].id] = fbPush(b,&o,4);
+			} else {
+				pos[f[i].id] = fbPush(b,&f[i].v,size); /* little endian */
+			}
+			if (f[i].id >= nids)
+				nids = f[i].id+1;
+		}
+	}
+	fbAlign(b,4,0);
+	tbl = fbPush(b,NULL,4);
+	vt[0] = 4+2*nids;
+	vt[1] = tbl-start;
+	for (i = 0; i < nids; i++) {
+		vt[2+i] = pos[i] ? tbl-pos[i] : 0;
+	}
+	soff = fbPush(b,vt,vt[0])-tbl;
+	memcpy(b->buf+b->cap-tbl,&soff,4);
+	return tbl;
+}
+
+/* root offset in front, returns the size of the finished buffer */
+static uint32_t fbFinish(struct fbb* const b, const uint32_t root) {
+	uint32_t o;
+
+	fbAlign(b,8,4);
+	o = b->len+4-root;
+	return fbPush(b,&o,4);
+}
+
+enum { ARROW_V5 = 4 }; /* MetadataVersion */
+enum { ARROW_SCHEMA = 1, ARROW_RECORDBATCH = 3 }; /* MessageHeader */
+enum { ARROW_INT = 2, ARROW_FLOAT = 3, ARROW_UTF8 = 5, ARROW_TIMESTAMP = 10 }; /* Type */
+
+static uint32_t arrowSchema(struct fbb* const b, const struct table* const t) {
+	uint32_t fields[NCOLS(trackCols)];
+	unsigned j;
+
+	for (j = 0; j < t->ncols; j++) {
+		const enum coltype ct = t->spec[j].type;
+		uint32_t type, name, children;
+		uint8_t tt;
+
+		if (ct == COL_F32) {
+			const struct fbfield f[] = { FB_VAL(0,2,1) }; /* SINGLE */
+
+			type = fbTable(b,f,1);
+			tt = ARROW_FLOAT;
+		} else if (ct == COL_STR) {
+			type = fbTable(b,NULL,0);
+			tt = ARROW_UTF8;
+		} else if (ct == COL_TIME) {
+			const uint32_t tz = fbString(b,"UTC");
+			const struct fbfield f[] = { FB_VAL(0,2,0), FB_REF(1,tz) }; /* SECOND */
+
+			type = fbTable(b,f,2);
+			tt = ARROW_TIMESTAMP;
+		} else {
+			const struct fbfield f[] = { FB_VAL(0,4,8*colSize[ct]), FB_VAL(1,1,0) };
+
+			type = fbTable(b,f,2);
+			tt = ARROW_INT;
+		}
+		name = fbString(b,t->spec[j].name);
+		children = fbRefs(b,NULL,0);
+		{
+			const struct fbfield f[] = { FB_REF(0,name), FB_VAL(1,1,0),
+				FB_VAL(2,1,tt), FB_REF(3,type), FB_REF(5,children) };
+
+			fields[j] = fbTable(b,f,5);
+		}
+	}
+	{
+		const struct fbfield f[] = { FB_VAL(0,2,0), /* little endian */
+			FB_REF(1,fbRefs(b,fields,t->ncols)) };
+
+		return fbTable(b,f,2);
+	}
+}
+
+/* continuation marker, length, Message; returns the bytes written */
+static uint32_t arrowMessage(struct table* const t, struct fbb* const b,
+			     const uint8_t type, const uint32_t header,
+			     const uint64_t body) {
+	const struct fbfield f[] = { FB_VAL(0,2,ARROW_V5), FB_VAL(1,1,type),
+		FB_REF(2,header), FB_VAL(3,8,body) };
+	const uint32_t len = fbFinish(b,fbTable(b,f,4));
+	const uint32_t pre[2] = { 0xFFFFFFFF, len };
+
+	fwrite(pre,4,2,t->f);
+	fwrite(b->buf+b->cap-len,1,len,t->f);
+	free(b->buf);
+	return 8+len;
+}
+
+static void arrowBegin(struct table* const t) {
+	struct fbb b = { 0 };
+
+	fwrite("ARROW1\0\0",1,8,t->f);
+	arrowMessage(t,&b,ARROW_SCHEMA,arrowSchema(&b,t),0);
+}
+
+static void arrowGroup(struct table* const t) {
+	struct { int64_t len, nulls; } nodes[NCOLS(trackCols)];
+	struct { int64_t off, len; } bufs[3*NCOLS(trackCols)];
+	struct fbb b = { 0 };
+	const uint64_t off = ftello(t->f);
+	uint64_t body = 0;
+	unsigned j, n = 0;
+	uint32_t meta;
+
+	for (j = 0; j < t->ncols; j++) {
+		nodes[j].len = t->rows;
+		nodes[j].nulls = 0;
+		bufs[n].off = body; /* no validity bitmap */
+		bufs[n++].len = 0;
+		if (t->spec[j].type == COL_STR) {
+			bufs[n].off = body;
+			bufs[n++].len = t->offs[j].len;
+			body += PAD8(t->offs[j].len);
+		}
+		bufs[n].off = body;
+		bufs[n++].len = t->data[j].len;
+		body += PAD8(t->data[j].len);
+	}
+	{
+		const uint32_t nv = fbStructs(&b,nodes,t->ncols,sizeof(nodes[0]));
+		const uint32_t bv = fbStructs(&b,bufs,n,sizeof(bufs[0]));
+		const struct fbfield f[] = { FB_VAL(0,8,t->rows), FB_REF(1,nv), FB_REF(2,bv) };
+
+		meta = arrowMessage(t,&b,ARROW_RECORDBATCH,fbTable(&b,f,3),body);
+	}
+	for (j = 0; j < t->ncols; j++) {
+		bufWrite(&t->offs[j],t->f); /* empty unless a string */
+		bufWrite(&t->data[j],t->f);
+	}
+	bufU64(&t->groups,off);
+	bufU64(&t->groups,meta);
+	bufU64(&t->groups,body);
+}
+
+static void arrowEnd(struct table* const t) {
+	struct { int64_t off; int32_t meta, pad; int64_t body; } blocks[64];
+	const uint64_t* const g = (const uint64_t*)t->groups.p;
+	const unsigned ng = t->groups.len/sizeof(*g)/3;
+	const uint32_t eos[2] = { 0xFFFFFFFF, 0 };
+	struct fbb b = { 0 };
+	uint32_t schema, dicts, batches, len;
+	unsigned i;
+
+	fwrite(eos,4,2,t->f);
+	schema = arrowSchema(&b,t);
+	dicts = fbStructs(&b,NULL,0,sizeof(blocks[0]));
+	/* built back to front, so in chunks from the last */
+	fbAlign(&b,8,ng*sizeof(blocks[0]));
+	for (i = ng; i > 0; ) {
+		const unsigned n = i < 64 ? i : 64;
+		unsigned k;
+
+		i -= n;
+		for (k = 0; k < n; k++) {
+			blocks[k].off = g[3*(i+k)];
+			blocks[k].meta = g[3*(i+k)+1];
+			blocks[k].pad = 0;
+			blocks[k].body = g[3*(i+k)+2];
+		}
+		fbPush(&b,blocks,n*sizeof(blocks[0]));
+	}
+	batches = fbPush(&b,&ng,4);
+	{
+		const struct fbfield f[] = { FB_VAL(0,2,ARROW_V5), FB_REF(1,schema),
+			FB_REF(2,dicts), FB_REF(3,batches) };
+
+		len = fbFinish(&b,fbTable(&b,f,4));
+	}
+	fwrite(b.buf+b.cap-len,1,len,t->f);
+	fwrite(&len,4,1,t->f);
+	fwrite("ARROW1",1,6,t->f);
+	free(b.buf);
+}
+
+/*** Parquet, one PLAIN encoded uncompressed page per column chunk ***/
+
+/* thrift compact protocol */
+struct thrift {
+	FILE* f;
+	int depth;
+	int16_t last[8]; /* previous field id per nested struct */
+};
+
+enum { T_I32 = 5, T_I64 = 6, T_BINARY = 8, T_LIST = 9, T_STRUCT = 12 };
+
+static void tVarint(FILE* f, uint64_t v) {
+	for (; v >= 0x80; v >>= 7) {
+		putc((v & 0x7F) | 0x80,f);
+	}
+	putc(v,f);
+}
+
+static void tField(struct thrift* const t, const int16_t id, const int type) {
+	const int d = id-t->last[t->depth];
+
+	if (d > 0 && d <= 15) {
+		putc(d << 4 | type,t->f);
+	} else {
+		putc(type,t->f);
+		tVarint(t->f,(uint16_t)(id << 1 ^ id >> 15));
+	}
+	t->last[t->depth] = id;
+}
+
+static void tI32(struct thrift* const t, const int16_t id, const int32_t v) {
+	tField(t,id,T_I32);
+	tVarint(t->f,(uint32_t)v << 1 ^ (uint32_t)(v >> 31));
+}
+
+static void tI64(struct thrift* const t, const int16_t id, const int64_t v) {
+	tField(t,id,T_I64);
+	tVarint(t->f,(uint64_t)v << 1 ^ (uint64_t)(v >> 63));
+}
+
+static void tRawString(struct thrift* const t, const char s[]) {
+	tVarint(t->f,strlen(s));
+	fputs(s,t->f);
+}
+
+static void tString(struct thrift* const t, const int16_t id, const char s[]) {
+	tField(t,id,T_BINARY);
+	tRawString(t,s);
+}
+
+static void tList(struct thrift* const t, const int16_t id, const int type,
+		  const unsigned n) {
+	tField(t,id,T_LIST);
+	if (n < 15) {
+		putc(n << 4 | type,t->f);
+	} else {
+		putc(0xF0 | type,t->f);
+		tVarint(t->f,n);
+	}
+}
+
+/* a struct as field (after tField(T_STRUCT)) or as list element */
+static void tBegin(struct thrift* const t) {
+	t->last[++t->depth] = 0;
+}
+
+static void tEnd(struct thrift* const t) {
+	putc(0,t->f);
+	t->depth--;
+}
+
+static void tStruct(struct thrift* const t, const int16_t id) {
+	tField(t,id,T_STRUCT);
+	tBegin(t);
+}
+
+enum { PQ_INT32 = 1, PQ_INT64 = 2, PQ_FLOAT = 4, PQ_BYTE_ARRAY = 6 };
+
+static const int pqType[] = { PQ_INT32, PQ_INT32, PQ_INT32, PQ_INT64, PQ_INT64,
+			      PQ_FLOAT, PQ_BYTE_ARRAY };
+static const int pqConverted[] = { 11, 12, 13, 14, 9, -1, 0 }; /* UINT_8.., TIMESTAMP_MILLIS, UTF8 */
+
+static uint32_t parquetSize(const struct table* const t, const unsigned j) {
+	switch (t->spec[j].type) {
+	case COL_U8:
+	case COL_U16:
+		return 4*t->rows;
+	case COL_STR:
+		return 4*t->rows+t->data[j].len;
+	default:
+		return t->data[j].len;
+	}
+}
+
+static void parquetValues(const struct table* const t, const unsigned j) {
+	const struct buf* const b = &t->data[j];
+	const uint32_t* const offs = (const uint32_t*)t->offs[j].p;
+	unsigned i;
+
+	for (i = 0; i < t->rows; i++) {
+		int32_t v32;
+		int64_t v64;
+		uint32_t n;
+
+		switch (t->spec[j].type) {
+		case COL_U8:
+			v32 = ((const uint8_t*)b->p)[i];
+			fwrite(&v32,4,1,t->f);
+			break;
+		case COL_U16:
+			v32 = ((const uint16_t*)b->p)[i];
+			fwrite(&v32,4,1,t->f);
+			break;
+		case COL_TIME:
+			v64 = ((const int64_t*)b->p)[i]*1000;
+			fwrite(&v64,8,1,t->f);
+			break;
+		case COL_STR:
+			n = offs[i+1]-offs[i];
+			fwrite(&n,4,1,t->f);
+			if (n)
+				fwrite(b->p+offs[i],1,n,t->f);
+			break;
+		default: /* same as in memory */
+			fwrite(b->p,1,b->len,t->f);
+			return;
+		}
+	}
+}
+
+static void parquetBegin(struct table* const t) {
+	fwrite("PAR1",1,4,t->f);
+}
+
+static void parquetGroup(struct table* const t) {
+	unsigned j;
+
+	bufU64(&t->groups,t->rows);
+	for (j = 0; j < t->ncols; j++) {
+		struct thrift th = { .f = t->f };
+		const uint64_t off = ftello(t->f);
+		const uint32_t n = parquetSize(t,j);
+
+		tI32(&th,1,0); /* DATA_PAGE */
+		tI32(&th,2,n);
+		tI32(&th,3,n);
+		tStruct(&th,5);
+		tI32(&th,1,t->rows);
+		tI32(&th,2,0); /* PLAIN */
+		tI32(&th,3,3); /* RLE, no levels for required columns */
+		tI32(&th,4,3);
+		tEnd(&th);
+		tEnd(&th);
+		parquetValues(t,j);
+		bufU64(&t->groups,off);
+		bufU64(&t->groups,ftello(t->f)-off);
+	}
+}
+
+static void parquetEnd(struct table* const t) {
+	const uint64_t* g = (const uint64_t*)t->groups.p;
+	const unsigned ng = t->groups.len/sizeof(*g)/(1+2*t->ncols);
+	struct thrift th = { .f = t->f };
+	const uint64_t start = ftello(t->f);
+	uint32_t len;
+	unsigned i, j;
+
+	tI32(&th,1,1); /* version */
+	tList(&th,2,T_STRUCT,t->ncols+1);
+	tBegin(&th);
+	tString(&th,4,"schema");
+	tI32(&th,5,t->ncols);
+	tEnd(&th);
+	for (j = 0; j < t->ncols; j++) {
+		tBegin(&th);
+		tI32(&th,1,pqType[t->spec[j].type]);
+		tI32(&th,3,0); /* REQUIRED */
+		tString(&th,4,t->spec[j].name);
+		if (pqConverted[t->spec[j].type] >= 0)
+			tI32(&th,6,pqConverted[t->spec[j].type]);
+		tEnd(&th);
+	}
+	tI64(&th,3,t->total);
+	tList(&th,4,T_STRUCT,ng);
+	for (i = 0; i < ng; i++, g += 1+2*t->ncols) {
+		uint64_t size = 0;
+
+		tBegin(&th);
+		tList(&th,1,T_STRUCT,t->ncols);
+		for (j = 0; j < t->ncols; j++) {
+			tBegin(&th);
+			tI64(&th,2,g[1+2*j]);
+			tStruct(&th,3); /* ColumnMetaData */
+			tI32(&th,1,pqType[t->spec[j].type]);
+			tList(&th,2,T_I32,1);
+			tVarint(t->f,0); /* PLAIN */
+			tList(&th,3,T_BINARY,1);
+			tRawString(&th,t->spec[j].name);
+			tI32(&th,4,0); /* UNCOMPRESSED */
+			tI64(&th,5,g[0]);
+			tI64(&th,6,g[2+2*j]);
+			tI64(&th,7,g[2+2*j]);
+			tI64(&th,9,g[1+2*j]);
+			tEnd(&th);
+			tEnd(&th);
+			size += g[2+2*j];
+		}
+		tI64(&th,2,size);
+		tI64(&th,3,g[0]);
+		tEnd(&th);
+	}
+	tString(&th,6,"libgr260");
+	tEnd(&th);
+	len = ftello(t->f)-start;
+	fwrite(&len,4,1,t->f);
+	fwrite("PAR1",1,4,t->f);
+}
+
+static const struct colformat colFormats[] = {
+	{ "arrow", ".arrow", arrowBegin, arrowGroup, arrowEnd },
+	{ "parquet", ".parquet", parquetBegin, parquetGroup, parquetEnd },
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+/*** tables ***/
+
+static struct table* tableNew(const struct sink* const s, const char name[],
+			      const struct colspec spec[], const unsigned ncols) {
+	struct table* const t = calloc(1,sizeof(struct table));
+
+	for (t->fmt = colFormats; strcmp(t->fmt->fmt,s->fmt); t->fmt++)
+		;
+	t->spec = spec;
+	t->ncols = ncols;
+	t->maxrows = s->rowgroup ? s->rowgroup : COL_ROWGROUP;
+	t->data = calloc(ncols,sizeof(struct buf));
+	t->offs = calloc(ncols,sizeof(struct buf));
+	t->path = malloc(strlen(s->path)+strlen(name)+strlen(t->fmt->ext)+2);
+	sprintf(t->path,"%s/%s%s",s->path,name,t->fmt->ext);
+	return t;
+}
+
+/* writes the pending rows as a group, the file is created on the first */
+static void tableFlush(struct table* const t) {
+	unsigned j;
+
+	if (!t->f && !t->failed) {
+		t->f = fopen(t->path,"w");
+		if (!t->f) {
+			perror(t->path);
+			t->failed = 1;
+		} else {
+			t->fmt->begin(t);
+		}
+	}
+	if (t->f && t->rows) {
+		t->fmt->group(t);
+	}
+	for (j = 0; j < t->ncols; j++) {
+		t->data[j].len = 0;
+		t->offs[j].len = 0;
+	}
+	t->rows = 0;
+}
+
+static void tableRow(struct table* const t, const union colval v[]) {
+	unsigned j;
+
+	for (j = 0; j < t->ncols; j++) {
+		struct buf* const b = &t->data[j];
+		uint32_t o = 0;
+
+		switch (t->spec[j].type) {
+		case COL_F32:
+			bufPut(b,&v[j].f,4);
+			break;
+		case COL_STR:
+			if (!t->rows)
+				bufPut(&t->offs[j],&o,4);
+			bufPut(b,v[j].s,strlen(v[j].s));
+			o = b->len;
+			bufPut(&t->offs[j],&o,4);
+			break;
+		default:
+			bufPut(b,&v[j].u,colSize[t->spec[j].type]); /* little endian */
+		}
+	}
+	t->total++;
+	if (++t->rows == t->maxrows) {
+		tableFlush(t);
+	}
+}
+
+static void tableClose(struct table* const t) {
+	unsigned j;
+
+	tableFlush(t);
+	if (t->f) {
+		t->fmt->end(t);
+		if (fclose(t->f))
+			perror(t->path);
+	}
+	for (j = 0; j < t->ncols; j++) {
+		free(t->data[j].p);
+		free(t->offs[j].p);
+	}
+	free(t->data);
+	free(t->offs);
+	free(t->groups.p);
+	free(t->path);
+	free(t);
+}
+
+/*** sink callbacks, arrow and parquet in sinkfmts[] ***/
+
+struct colpriv {
+	struct table* wps;
+	struct table* tracks;
+	time_t first, last;
+};
+
+static struct colpriv* colPriv(struct sink* const s) {
+	if (!s->priv) {
+		s->priv = calloc(1,sizeof(struct colpriv));
+	}
+	return s->priv;
+}
+
+void columnarTrackInfo(struct sink* s, const struct tlist* tl) {
+	struct colpriv* const cp = colPriv(s);
+	const trackinfo* const ti = &tl->ti;
+	char name[TRACK_NAME_UTF8];
+
+	if (!cp->tracks) {
+		cp->tracks = tableNew(s,"tracks",trackCols,NCOLS(trackCols));
+	}
+	trackNameUtf8(ti,name);
+	{
+		const union colval v[] = {
+			{ .u = tl->num }, { .u = ti->unk0 }, { .s = name },
+			{ .u = ti->timestamp+ts_offset }, { .u = ti->duration },
+			{ .u = ti->length }, { .u = ti->start_addr }, { .u = ti->size },
+			{ .u = ti->unk1 }, { .u = ti->unk2 }, { .u = ti->unk3 },
+			{ .u = ti->unk4 }, { .u = ti->unk5 }, { .u = ti->unk6 },
+			{ .u = ti->unk7 }, { .u = ti->unk8 }, { .u = ti->unk9 },
+		};
+
+		tableRow(cp->tracks,v);
+	}
+}
+
+void columnarPoint(struct sink* s, const wpcols* c, const unsigned i,
+		   const waypoint* wp, const struct tm __attribute__((unused)) *ptm) {
+	struct colpriv* const cp = colPriv(s);
+	const union colval v[] = {
+		{ .u = s->tracknum }, { .u = c->ts[i] }, { .f = c->lat[i] },
+		{ .f = c->lon[i] }, { .u = c->altgps[i] }, { .u = c->speed[i] },
+		{ .u = wp->unk1 }, { .u = wp->unk2 }, { .u = wp->is_poi },
+		{ .u = c->hbr[i] }, { .u = c->altbar[i] }, { .u = c->heading[i] },
+		{ .u = c->dist[i] }, { .u = wp->unk7 },
+		{ .s = s->source ? s->source : "" },
+	};
+
+	if (!cp->wps) {
+		cp->wps = tableNew(s,"waypoints",wpCols,
+				   NCOLS(wpCols)-!s->source);
+		cp->first = cp->last = c->ts[i];
+	}
+	if (c->ts[i] < cp->first)
+		cp->first = c->ts[i];
+	if (c->ts[i] > cp->last)
+		cp->last = c->ts[i];
+	tableRow(cp->wps,v);
+}
+
+void columnarFooter(struct sink* s,
+		    const struct plist __attribute__((unused)) *poilist) {
+	struct colpriv* const cp = colPriv(s);
+	struct table* const dev = tableNew(s,"device",deviceCols,NCOLS(deviceCols));
+
+	if (!cp->wps) {
+		cp->wps = tableNew(s,"waypoints",wpCols,NCOLS(wpCols)-1);
+	}
+	if (!cp->tracks) {
+		cp->tracks = tableNew(s,"tracks",trackCols,NCOLS(trackCols));
+	}
+	{
+		const union colval v[] = {
+			{ .s = s->model }, { .u = s->fwver }, { .u = cp->tracks->total },
+			{ .u = cp->wps->total }, { .u = cp->first }, { .u = cp->last },
+		};
+
+		tableRow(dev,v);
+	}
+	tableClose(dev);
+	tableClose(cp->tracks);
+	tableClose(cp->wps);
+	free(cp);
+	s->priv = NULL;
+}
@@ -0,0 +1,184 @@
+/* elevation from SRTM tiles, <dir>/N49E019.hgt and the like: 1" (3601
+ * samples a side) or 3" (1201), big endian int16 metres, rows from north
+ * to south.  Tiles are mapped when first needed and kept in a small LRU;
+ * a missing tile is remembered too, so it isn't looked for at every point. */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+#define DEM_TILES 16
+#define DEM_VOID -32768
+
+struct tile {
+	int lat, lon; /* south west corner */
+	const uint8_t* base; /* NULL if there's no such tile */
+	size_t len;
+	unsigned n; /* samples a side */
+	unsigned long used;
+};
+
+struct dem {
+	char* dir;
+	struct tile tiles[DEM_TILES];
+	unsigned ntiles;
+	unsigned long clock;
+	struct tile* last;
+};
+
+struct dem* demOpen(const char dir[]) {
+	struct dem* const d = calloc(1,sizeof(struct dem));
+
+	d->dir = strdup(dir);
+	return d;
+}
+
+static void tileUnmap(struct tile* const t) {
+	if (t->base) {
+		munmap((void*)t->base,t->len);
+	}
+	t->base = NULL;
+}
+
+void demClose(struct dem* d) {
+	unsigned i;
+
+	if (!d) {
+		return;
+	}
+	for (i = 0; i < d->ntiles; i++) {
+		tileUnmap(&d->tiles[i]);
+	}
+	free(d->dir);
+	free(d);
+}
+
+static void tileMap(const struct dem* const d, struct tile* const t) {
+	char path[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	snprintf(path,sizeof(path),"%s/%c%02d%c%03d.hgt",d->dir,
+		 t->lat < 0 ? 'S' : 'N',abs(t->lat),t->lon < 0 ? 'W' : 'E',abs(t->lon));
+	fd = open(path,O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	if (!fstat(fd,&st)) {
+		const unsigned n = sqrt(st.st_size/2);
+
+		if (n > 1 && (off_t)n*n*2 == st.st_size) {
+			void* const p = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+
+			if (p != MAP_FAILED) {
+				t->base = p;
+				t->len = st.st_size;
+				t->n = n;
+			}
+		}
+	}
+	close(fd);
+}
+
+static const struct tile* demTile(struct dem* const d, const int lat, const int lon) {
+	struct tile* t = d->last;
+	unsigned i;
+
+	if (t && t->lat == lat && t->lon == lon) {
+		t->used = ++d->clock;
+		return t;
+	}
+	for (i = 0; i < d->ntiles; i++) {
+		t = &d->tiles[i];
+		if (t->lat == lat && t->lon == lon) {
+			t->used = ++d->clock;
+			return d->last = t;
+		}
+	}
+	if (d->ntiles < DEM_TILES) {
+		t = &d->tiles[d->ntiles++];
+	} else { /* the least recently used goes */
+		for (i = 1, t = d->tiles; i < DEM_TILES; i++) {
+			if (d->tiles[i].used < t->used)
+				t = &d->tiles[i];
+		}
+		tileUnmap(t);
+	}
+	t->lat = lat;
+	t->lon = lon;
+	tileMap(d,t);
+	t->used = ++d->clock;
+	return d->last = t;
+}
+
+static int tileSample(const struct tile* const t, const unsigned row, const unsigned col) {
+	const uint8_t* const p = t->base+2*((size_t)row*t->n+col);
+
+	return (int16_t)(p[0] << 8 | p[1]);
+}
+
+/* bilinear between the four samples around lat/lon, voids left out;
+ * returns 0 where there is no data */
+static int demLookup(struct dem* const d, const double lat, const double lon,
+		     double* const alt) {
+	const struct tile* t;
+	double y, x, fy, fx, sum = 0, wsum = 0;
+	unsigned row, col, k;
+	int la, lo;
+
+	if (!(fabs(lat) < 90 && fabs(lon) < 180)) { /* NaN too */
+		return 0;
+	}
+	la = floor(lat);
+	lo = floor(lon);
+	t = demTile(d,la,lo);
+	if (!t->base) {
+		return 0;
+	}
+	y = (la+1-lat)*(t->n-1);
+	x = (lon-lo)*(t->n-1);
+	row = MIN((unsigned)y,t->n-2);
+	col = MIN((unsigned)x,t->n-2);
+	fy = y-row;
+	fx = x-col;
+	for (k = 0; k < 4; k++) {
+		const int h = tileSample(t,row+k/2,col+k%2);
+		const double w = (k/2 ? fy : 1-fy)*(k%2 ? fx : 1-fx);
+
+		if (h != DEM_VOID) {
+			sum += w*h;
+			wsum += w;
+		}
+	}
+	if (wsum <= 0) {
+		return 0;
+	}
+	*alt = sum/wsum;
+	return 1;
+}
+
+/* altdem of a decoded block, altgps where the tiles have nothing */
+void demFill(struct dem* const d, wpcols* const c) {
+	unsigned i;
+
+	for (i = 0; i < c->n; i++) {
+		double alt;
+
+		if (demLookup(d,c->lat[i],c->lon[i],&alt)) {
+			c->altdem[i] = alt <= 0 ? 0 : alt >= UINT16_MAX ? UINT16_MAX : lround(alt);
+		} else {
+			c->altdem[i] = c->altgps[i];
+		}
+	}
+}
+
+const char* demDir(const struct dem* const d) {
+	return d->dir;
+}
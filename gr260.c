@@ -0,0 +1,1008 @@
+/* libgr260: protocol, decoding and export of GR260 data */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#ifdef __x86_64__ /* the AVX2 decoder stores 64-bit time_t */
+#include <immintrin.h>
+#endif
+#include "gr260int.h"
+
+const char* cmds[] = { //	answers:
+	"PHLX810", //*35		$PHLX852,GR260*3E
+	"PHLX829", //*3F		$PHLX861,201*2C - firmware version
+	"PHLX826", //*30		$PHLX859*38 - disp. usb icon
+	"PHLX701", //*3A		$PHLX601,18*1E - track count
+	"PHLX702,0,", //*00		$PHLX900,702,3*33
+		      //		$PHLX901,1152,FBFF1991*37 - 2nd line of response
+	"PHLX900,901,3", //*3E		$PHLX902,0,1152,FBFF1991*28
+	"PHLX900,902,3", //*3D		$PHLX902,30720,2048,AB690FC3*29
+	"PHLX900,902,3",//*3D		binary data (264B+165+...)
+//	"PHLX831",//*36			$PHLX863,GPSport260*74 #bye?
+	"PHLX827",
+/*9*/	"PHLX703,",//			request transmission of data between <start> and <end>
+	"PHLX900,902,2", //*3C"		request retransmission of last packet
+	NULL
+};
+
+const char* rets[] = {
+	"$PHLX852,GR260", //*3E
+	"$PHLX861,", //201*2C //firmware version
+	"$PHLX859*38",
+	"$PHLX601,", //18*1E //number of tracks
+	"$PHLX900,702,", //3*33
+/*5*/	"$PHLX901,",
+	"$PHLX902,",
+	"$PHLX900,703,3*32",
+	NULL
+};
+
+FILE* gCommDump = NULL;
+
+int send_message(const int fh, const char cmd[]) {
+	char buf[32];
+	unsigned i;
+	int rv;
+	unsigned char xors = 0;
+			
+	for (i = 0;cmd[i];i++) {
+		xors ^= cmd[i];
+	}
+	i = sprintf(buf,"$%s*%02hhX\r\n",cmd,xors);
+	rv = write(fh,buf,i);
+	PROBE(send,cmd,rv);
+	COMMPRINTF("$%s*%02hhX -> ",cmd,xors);
+	return rv;
+}
+
+int send_cmd(const int fh, const cmd_t cmd, ...) {
+	char cmdbuf[32];
+	va_list vl;
+
+	va_start(vl,cmd);
+	if (cmd == CMD_TRACKS) {
+		const int trackcnt = va_arg(vl,int);
+		sprintf(cmdbuf,"%s%d",cmds[cmd],trackcnt);
+	} else if (cmd == CMD_REQTDATA) {
+		const int startaddr = va_arg(vl,int);
+		const int endaddr = va_arg(vl,int);
+		sprintf(cmdbuf,"%s%d,%d",cmds[cmd],startaddr,endaddr);
+	} else {
+		strcpy(cmdbuf,cmds[cmd]);
+	}
+	va_end(vl);
+	return send_message(fh,cmdbuf);
+}
+
+int my_strcmp(const char s1[], const char s2[]) {
+	return strncmp(s1,s2,strlen(s2));
+}
+
+static uint32_t crcTable[256];
+
+static void crcInit(void) {
+	uint32_t i, j, c;
+
+	for (i = 0; i < 256; i++) {
+		for (c = i, j = 0; j < 8; j++) {
+			c = c & 1 ? 0xEDB88320^(c >> 1) : c >> 1;
+		}
+		crcTable[i] = c;
+	}
+}
+
+/* IEEE 802.3 CRC-32; a guess at what $PHLX901/902 report, see TODO */
+uint32_t crc32Update(uint32_t crc, const void* buf, size_t len) {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	const unsigned char* p = buf;
+
+	pthread_once(&once,crcInit); /* dumps are opened from several threads */
+	crc = ~crc;
+	while (len--) {
+		crc = crcTable[(crc^*p++) & 0xFF]^(crc >> 8);
+	}
+	return ~crc;
+}
+
+void set_speed(const int fh, struct termios* const pterm,const speed_t speed) {
+	cfsetispeed(pterm,speed);
+	cfsetospeed(pterm,speed);
+	if (tcsetattr(fh,TCSANOW,pterm) < 0) {
+		perror("tcsetattr");
+	}
+	PROBE(speed,(unsigned)speed); /* a Bxxx code */
+}
+
+void trackListPrepend(const char rbuf[], const int ridx,
+		      struct tlist** const tl) {
+	int i;
+
+	for (i = 0; i < ridx; i+= sizeof(trackinfo)) {
+		trackinfo *ti = (trackinfo*)(rbuf+i);
+		struct tlist* ntl;
+
+		/* prepend track list with new entry */
+		ntl = malloc(sizeof(struct tlist));
+		ntl->prev = *tl;
+		ntl->ti = *ti; /* copy data */
+		ntl->num = *tl ? (*tl)->num+1 : 1;
+		*tl = ntl;
+	}
+}
+
+void freeTracks(struct tlist* tl) {
+	while (tl) {
+		struct tlist* tmp = tl->prev;
+		free(tl);
+		tl = tmp;
+	}
+}
+
+void dumpTracks(const struct tlist* from, const struct tlist* const to) {
+	char tbuf[64];
+
+	if (!to) {
+		return;
+	}
+	while (from != to) {
+		const struct tlist* tl = to;
+		while (tl->prev != from) {
+		       tl = tl->prev;
+		}
+		const trackinfo *ti = &(tl->ti);
+		time_t t = ti->timestamp + ts_offset;
+		struct tm tm;
+
+		strftime(tbuf,sizeof(tbuf),"%T",gmtime_r(&t,&tm));
+		printf("%2d: %08X %10s %s %5ds %6dm %4X@%06X"
+			" %05d %05d %05d %05d %08X %08X %03X %03X %u\n",
+			tl->num, ti->unk0,
+			ti->name[0] != '\377'?ti->name:"(none)",
+			tbuf, ti->duration, ti->length, ti->size,
+			ti->start_addr, ti->unk1, ti->unk2, ti->unk3, ti->unk4,
+			ti->unk5, ti->unk6, ti->unk7, ti->unk8, ti->unk9);
+		from = tl;
+	}
+}
+
+static void wpcolsReserve(wpcols* const c, const unsigned n) {
+	if (n <= c->cap) {
+		return;
+	}
+	c->cap = (n+7) & ~7u;
+	c->ts = realloc(c->ts,c->cap*sizeof(*c->ts));
+	c->lat = realloc(c->lat,c->cap*sizeof(*c->lat));
+	c->lon = realloc(c->lon,c->cap*sizeof(*c->lon));
+	c->altgps = realloc(c->altgps,c->cap*sizeof(*c->altgps));
+	c->altbar = realloc(c->altbar,c->cap*sizeof(*c->altbar));
+	c->altdem = realloc(c->altdem,c->cap*sizeof(*c->altdem));
+	c->speed = realloc(c->speed,c->cap*sizeof(*c->speed));
+	c->heading = realloc(c->heading,c->cap*sizeof(*c->heading));
+	c->hbr = realloc(c->hbr,c->cap*sizeof(*c->hbr));
+	c->dist = realloc(c->dist,c->cap*sizeof(*c->dist));
+	c->poi = realloc(c->poi,c->cap/8);
+	if (!c->ts || !c->lat || !c->lon || !c->altgps || !c->altbar || !c->altdem || !c->speed
+	    || !c->heading || !c->hbr || !c->dist || !c->poi) {
+		perror("realloc");
+		abort();
+	}
+}
+
+static void wpcolsFree(wpcols* const c) {
+	free(c->ts);
+	free(c->lat);
+	free(c->lon);
+	free(c->altgps);
+	free(c->altbar);
+	free(c->altdem);
+	free(c->speed);
+	free(c->heading);
+	free(c->hbr);
+	free(c->dist);
+	free(c->poi);
+}
+
+/* decodes records [from,to) */
+static void decodeWaypointsScalar(const char rbuf[], const unsigned from,
+				  const unsigned to, wpcols* const c) {
+	unsigned i;
+
+	for (i = from; i < to; i++) {
+		const waypoint *wp = (const waypoint*)(rbuf+i*sizeof(waypoint));
+
+		c->ts[i] = (time_t)wp->timestamp + ts_offset;
+		c->lat[i] = wp->lat;
+		c->lon[i] = wp->lon;
+		c->altgps[i] = wp->altgps;
+		c->altbar[i] = wp->altbar;
+		c->speed[i] = wp->speed;
+		c->heading[i] = wp->heading;
+		c->hbr[i] = wp->hbr;
+		c->dist[i] = wp->dist;
+		if (wp->is_poi) {
+			c->poi[i/8] |= 1 << (i%8);
+		} else {
+			c->poi[i/8] &= ~(1 << (i%8));
+		}
+	}
+}
+
+#ifdef __x86_64__
+/* 8 records per iteration: gather each 32-bit word of the record,
+ * then split the 16-bit halves */
+__attribute__((target("avx2")))
+static void decodeWaypointsAvx2(const char rbuf[], const unsigned n,
+				wpcols* const c) {
+	const __m256i vidx = _mm256_setr_epi32(0,8,16,24,32,40,48,56);
+	const __m256i lo16 = _mm256_set1_epi32(0xFFFF);
+	const __m256i tsoff = _mm256_set1_epi64x(ts_offset);
+	unsigned i;
+
+	for (i = 0; i+8 <= n; i += 8) {
+		const int* base = (const int*)(rbuf+i*sizeof(waypoint));
+		const __m256i w0 = _mm256_i32gather_epi32(base+0,vidx,4);
+		const __m256i w1 = _mm256_i32gather_epi32(base+1,vidx,4);
+		const __m256i w2 = _mm256_i32gather_epi32(base+2,vidx,4);
+		const __m256i w3 = _mm256_i32gather_epi32(base+3,vidx,4);
+		const __m256i w4 = _mm256_i32gather_epi32(base+4,vidx,4);
+		const __m256i w5 = _mm256_i32gather_epi32(base+5,vidx,4);
+		const __m256i w6 = _mm256_i32gather_epi32(base+6,vidx,4);
+		__m256i t;
+
+		t = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(w0)),tsoff);
+		_mm256_storeu_si256((__m256i*)(c->ts+i),t);
+		t = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(w0,1)),tsoff);
+		_mm256_storeu_si256((__m256i*)(c->ts+i+4),t);
+		_mm256_storeu_si256((__m256i*)(c->lat+i),w1);
+		_mm256_storeu_si256((__m256i*)(c->lon+i),w2);
+		_mm256_storeu_si256((__m256i*)(c->dist+i),w6);
+
+		/* packus works within 128-bit lanes, permute restores order */
+		t = _mm256_packus_epi32(_mm256_and_si256(w3,lo16),_mm256_srli_epi32(w3,16));
+		t = _mm256_permute4x64_epi64(t,0xD8);
+		_mm_storeu_si128((__m128i*)(c->altgps+i),_mm256_castsi256_si128(t));
+		_mm_storeu_si128((__m128i*)(c->speed+i),_mm256_extracti128_si256(t,1));
+		t = _mm256_packus_epi32(_mm256_and_si256(w5,lo16),_mm256_srli_epi32(w5,16));
+		t = _mm256_permute4x64_epi64(t,0xD8);
+		_mm_storeu_si128((__m128i*)(c->altbar+i),_mm256_castsi256_si128(t));
+		_mm_storeu_si128((__m128i*)(c->heading+i),_mm256_extracti128_si256(t,1));
+		t = _mm256_packus_epi32(_mm256_srli_epi32(w4,16),_mm256_setzero_si256());
+		t = _mm256_permute4x64_epi64(t,0xD8);
+		_mm_storeu_si128((__m128i*)(c->hbr+i),_mm256_castsi256_si128(t));
+
+		/* is_poi is the high nibble of the 2nd byte of word 4 */
+		t = _mm256_and_si256(w4,_mm256_set1_epi32(0xF000));
+		t = _mm256_cmpeq_epi32(t,_mm256_setzero_si256());
+		c->poi[i/8] = ~_mm256_movemask_ps(_mm256_castsi256_ps(t));
+	}
+	decodeWaypointsScalar(rbuf,i,n,c);
+}
+#endif
+
+static void decodeWaypointsGeneric(const char rbuf[], const unsigned n,
+				   wpcols* const c) {
+	decodeWaypointsScalar(rbuf,0,n,c);
+}
+
+static void (*decodeWaypointsImpl)(const char[], const unsigned,
+				   wpcols* const) = decodeWaypointsGeneric;
+
+static void decodeWaypointsInit(void) {
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		decodeWaypointsImpl = decodeWaypointsAvx2;
+	}
+#endif
+}
+
+/* converts len bytes of waypoint records into columns */
+void decodeWaypoints(const char rbuf[], const int len, wpcols* const c) {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	const unsigned n = len/sizeof(waypoint);
+
+	pthread_once(&once,decodeWaypointsInit); /* -f decodes in several threads */
+	wpcolsReserve(c,n);
+	decodeWaypointsImpl(rbuf,n,c);
+	c->n = n;
+}
+
+/* same as gmtime_r(), but only the time of day is worked out again
+ * while t stays within the day of the previous call */
+const struct tm* tmCached(const time_t t, tmcache* const tc) {
+	const time_t sec = t-tc->day;
+
+	if (tc->valid && sec >= 0 && sec < 24*3600) {
+		tc->tm.tm_hour = sec/3600;
+		tc->tm.tm_min = sec/60%60;
+		tc->tm.tm_sec = sec%60;
+	} else {
+		gmtime_r(&t,&tc->tm);
+		tc->day = t-(tc->tm.tm_hour*3600+tc->tm.tm_min*60+tc->tm.tm_sec);
+		tc->valid = 1;
+	}
+	return &tc->tm;
+}
+
+/* the newest track starting at or before wpnum, where a new one may
+ * start is kept in nextcheck so the list isn't walked for every point */
+static const struct tlist* currentTrack(struct gr260_export* const ex) {
+	const struct tlist* itl;
+
+	ex->nextcheck = UINT32_MAX;
+	for (itl = ex->tracklist; itl; itl = itl->prev) {
+		if (itl->ti.start_addr <= ex->wpnum) {
+			break;
+		}
+		ex->nextcheck = MIN(ex->nextcheck,itl->ti.start_addr);
+	}
+	return itl;
+}
+
+void dumpWaypoints(struct gr260_export* const ex, const char rbuf[],
+		   const int len) {
+	wpcols* const c = &ex->cols;
+	struct sink* const sl = ex->sinks;
+	const struct tlist* itl;
+	struct sink* s;
+	unsigned i;
+
+	decodeWaypoints(rbuf,len,c);
+	if (ex->dem) {
+		demFill(ex->dem,c);
+	}
+	for (s = sl; s; s = s->next) {
+		s->alt = s->usedem ? c->altdem : s->usealtbar ? c->altbar : c->altgps;
+	}
+	for (i = 0; i < c->n; i++) {
+		const waypoint *wp = (const waypoint*)(rbuf+i*sizeof(waypoint));
+		const struct tm* const ptm = tmCached(c->ts[i],&ex->tmc);
+		const char* const src = ex->src ? ex->src[i] : NULL;
+		const unsigned srctrack = ex->srctrack ? ex->srctrack[i] : 0;
+
+		if (!ex->started) {
+			ex->started = 1;
+			ex->wpnum = ex->wpbase;
+			ex->tracknum = ex->srctrack ? srctrack
+				: ex->trackbase ? ex->trackbase : 1;
+			ex->nextcheck = 0;
+			for (s = sl; s; s = s->next) {
+				ex->pois |= s->pois;
+				s->source = src;
+				if (s->header)
+					s->header(s);
+			}
+			sinksTrackStart(sl,ex->tracknum,ex->tracklist);
+		} else if (ex->srctrack && (srctrack != ex->tracknum
+						    || (sl && src != sl->source))) {
+			sinksTrackEnd(sl); /* still with the previous point's source */
+			ex->tracknum = srctrack;
+			sinksTrackStart(sl,ex->tracknum,ex->tracklist);
+		}
+		if (ex->pois && (c->poi[i/8] & (1 << (i%8)))) {
+			struct plist *newpoi = malloc(sizeof(struct plist));
+			newpoi->prev = ex->poilist;
+			newpoi->poi = *wp;
+			ex->poilist = newpoi;
+		}
+		if (!ex->srctrack && ex->wpnum >= ex->nextcheck
+		    && (itl = currentTrack(ex)) && itl->num != ex->tracknum) {
+			sinksTrackEnd(sl);
+			ex->tracknum++;
+			sinksTrackStart(sl,ex->tracknum,ex->tracklist);
+			ex->nextcheck = ex->wpnum+1; /* may be behind by more than one */
+		}
+		for (s = sl; s; s = s->next) {
+			if (!s->npts)
+				s->dist0 = c->dist[i];
+			s->source = src;
+			s->point(s,c,i,wp,ptm);
+			s->npts++;
+		}
+		ex->wpnum ++;
+	}
+	PROBE(export,c->n,ex->wpnum);
+	sinksFlush(sl);
+}
+
+/* adds a block of track list to ex and passes new entries to sinks */
+void exportTracklist(struct gr260_export* const ex, const char rbuf[],
+		     const int len) {
+	const struct tlist* from = ex->tracklist;
+
+	trackListPrepend(rbuf,len,&ex->tracklist);
+	ex->nextcheck = 0;
+	sinksTrackInfo(ex->sinks,ex->tracklist,from);
+	sinksFlush(ex->sinks);
+}
+
+/*** parallel export of a complete image ***/
+
+/* tracks are cut into pieces which workers format into memory,
+ * the main thread writes them out in order; the record index passed
+ * to point() stays relative to the device block, as in dumpWaypoints() */
+#define BLOCK_WPS (unsigned)(BLOCK_SIZE/sizeof(waypoint))
+#define PIECE_WPS (64*BLOCK_WPS)
+
+struct piece {
+	unsigned from, to; /* waypoints */
+	unsigned tracknum, trackfrom;
+	int start, end; /* has the track's start/end */
+	int done;
+	char** out; /* one buffer per sink */
+	size_t* outlen;
+};
+
+struct pexport {
+	struct gr260_export* ex;
+	const waypoint* wps;
+	unsigned nwps, nsinks;
+	struct piece* pieces;
+	unsigned npieces;
+	atomic_uint next;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void formatPiece(struct pexport* const pe, struct piece* const p,
+			wpcols* const c, struct dem* const dem, struct sink cs[]) {
+	tmcache tc = { 0 };
+	struct sink* s;
+	unsigned b, i, j;
+
+	for (s = pe->ex->sinks, j = 0; s; s = s->next, j++) {
+		cs[j] = *s;
+		cs[j].f = open_memstream(&p->out[j],&p->outlen[j]);
+		cs[j].tracknum = p->tracknum;
+		cs[j].ti = trackByNum(pe->ex->tracklist,p->tracknum);
+		cs[j].npts = p->from-p->trackfrom;
+		cs[j].dist0 = pe->wps[p->trackfrom].dist;
+		if (p->start && cs[j].trackStart)
+			cs[j].trackStart(&cs[j]);
+	}
+	for (b = p->from-p->from%BLOCK_WPS; b < p->to; b += BLOCK_WPS) {
+		const unsigned n = MIN(BLOCK_WPS,pe->nwps-b);
+		const char* const rbuf = (const char*)(pe->wps+b);
+
+		decodeWaypoints(rbuf,n*sizeof(waypoint),c);
+		if (dem) {
+			demFill(dem,c);
+		}
+		for (j = 0; j < pe->nsinks; j++) {
+			cs[j].alt = cs[j].usedem ? c->altdem : cs[j].usealtbar ? c->altbar : c->altgps;
+		}
+		for (i = p->from > b ? p->from-b : 0; i < MIN(p->to-b,n); i++) {
+			const waypoint* wp = (const waypoint*)(rbuf+i*sizeof(waypoint));
+			const struct tm* const ptm = tmCached(c->ts[i],&tc);
+
+			for (j = 0; j < pe->nsinks; j++) {
+				if (!cs[j].npts)
+					cs[j].dist0 = c->dist[i];
+				cs[j].point(&cs[j],c,i,wp,ptm);
+				cs[j].npts++;
+			}
+		}
+	}
+	for (j = 0; j < pe->nsinks; j++) {
+		if (p->end && cs[j].trackEnd)
+			cs[j].trackEnd(&cs[j]);
+		fclose(cs[j].f);
+	}
+}
+
+static void* exportWorker(void* arg) {
+	struct pexport* const pe = arg;
+	struct sink* const cs = malloc(pe->nsinks*sizeof(struct sink));
+	/* tiles are mapped per worker, the cache isn't shared */
+	struct dem* const dem = pe->ex->dem ? demOpen(demDir(pe->ex->dem)) : NULL;
+	wpcols c = { 0 };
+	unsigned k;
+
+	while ((k = atomic_fetch_add(&pe->next,1)) < pe->npieces) {
+		formatPiece(pe,&pe->pieces[k],&c,dem,cs);
+		pthread_mutex_lock(&pe->lock);
+		pe->pieces[k].done = 1;
+		pthread_cond_broadcast(&pe->cond);
+		pthread_mutex_unlock(&pe->lock);
+	}
+	wpcolsFree(&c);
+	demClose(dem);
+	free(cs);
+	return NULL;
+}
+
+/* a track in pieces of at most PIECE_WPS, the last track is left open */
+static void addTrack(struct pexport* const pe, const unsigned tracknum,
+		     const unsigned from, const unsigned to, const int last) {
+	unsigned i = from;
+
+	do {
+		struct piece* p;
+
+		if (!(pe->npieces & (pe->npieces+1))) { /* 0, 1, 3, 7, ... */
+			pe->pieces = realloc(pe->pieces,(2*pe->npieces+1)*sizeof(struct piece));
+		}
+		p = &pe->pieces[pe->npieces++];
+		memset(p,0,sizeof(*p));
+		p->from = i;
+		p->to = MIN(i+PIECE_WPS,to);
+		p->tracknum = tracknum;
+		p->trackfrom = from;
+		p->start = i == from;
+		p->end = p->to == to && !last;
+		p->out = calloc(pe->nsinks,sizeof(char*));
+		p->outlen = calloc(pe->nsinks,sizeof(size_t));
+		i = p->to;
+	} while (i < to);
+}
+
+/* same track boundaries and POIs as dumpWaypoints() would give;
+ * the list lookup is redone only where a track may start */
+static void splitTracks(struct pexport* const pe) {
+	struct gr260_export* const ex = pe->ex;
+	const struct tlist* itl = NULL;
+	const struct sink* s;
+	unsigned i, next = 0, tracknum = 1, trackfrom = 0;
+
+	for (s = ex->sinks; s; s = s->next) {
+		ex->pois |= s->pois;
+	}
+	for (i = 0; i < pe->nwps; i++) {
+		if (ex->pois && pe->wps[i].is_poi) {
+			struct plist *newpoi = malloc(sizeof(struct plist));
+			newpoi->prev = ex->poilist;
+			newpoi->poi = pe->wps[i];
+			ex->poilist = newpoi;
+		}
+		if (i == next) {
+			const struct tlist* tl;
+
+			next = UINT32_MAX;
+			for (itl = NULL, tl = ex->tracklist; tl; tl = tl->prev) {
+				if (!itl && tl->ti.start_addr <= i) {
+					itl = tl;
+				}
+				if (tl->ti.start_addr > i) {
+					next = MIN(next,tl->ti.start_addr);
+				}
+			}
+		}
+		if (itl && itl->num != tracknum) {
+			addTrack(pe,tracknum,trackfrom,i,0);
+			tracknum++;
+			trackfrom = i;
+		}
+	}
+	addTrack(pe,tracknum,trackfrom,pe->nwps,1);
+	ex->wpnum = pe->nwps;
+	ex->tracknum = tracknum;
+}
+
+/* returns 0 if ex is not suitable, the caller exports sequentially */
+static int exportParallel(struct gr260_export* const ex, const waypoint wps[],
+			  const unsigned nwps) {
+	struct pexport pe = { .ex = ex, .wps = wps, .nwps = nwps };
+	unsigned nthreads = ex->nthreads ? ex->nthreads : sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t* threads;
+	struct sink* s;
+	unsigned i, j;
+
+	for (s = ex->sinks; s; s = s->next, pe.nsinks++) {
+		if (!s->parallel)
+			return 0;
+	}
+	if (nthreads < 2 || !pe.nsinks || ex->started || nwps <= BLOCK_WPS) {
+		return 0;
+	}
+	splitTracks(&pe);
+	ex->started = 1;
+	for (s = ex->sinks; s; s = s->next) {
+		if (s->header)
+			s->header(s);
+	}
+	nthreads = MIN(nthreads,pe.npieces);
+	threads = malloc(nthreads*sizeof(pthread_t));
+	pthread_mutex_init(&pe.lock,NULL);
+	pthread_cond_init(&pe.cond,NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i],NULL,exportWorker,&pe)) {
+			break;
+		}
+	}
+	nthreads = i;
+	if (!nthreads) { /* do it ourselves then */
+		exportWorker(&pe);
+	}
+	for (i = 0; i < pe.npieces; i++) {
+		struct piece* const p = &pe.pieces[i];
+
+		pthread_mutex_lock(&pe.lock);
+		while (!p->done)
+			pthread_cond_wait(&pe.cond,&pe.lock);
+		pthread_mutex_unlock(&pe.lock);
+		for (s = ex->sinks, j = 0; s; s = s->next, j++) {
+			fwrite(p->out[j],1,p->outlen[j],s->f);
+			free(p->out[j]);
+		}
+		free(p->out);
+		free(p->outlen);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i],NULL);
+	}
+	pthread_mutex_destroy(&pe.lock);
+	pthread_cond_destroy(&pe.cond);
+	/* the last track is ended by sinksClose() */
+	for (s = ex->sinks; s; s = s->next) {
+		const struct piece* const p = &pe.pieces[pe.npieces-1];
+
+		s->tracknum = p->tracknum;
+		s->ti = trackByNum(ex->tracklist,p->tracknum);
+		s->npts = nwps-p->trackfrom;
+		s->dist0 = wps[p->trackfrom].dist;
+	}
+	free(pe.pieces);
+	free(threads);
+	return 1;
+}
+
+/* all waypoints at once, in parallel where the sinks allow it */
+void exportImage(struct gr260_export* const ex, const waypoint wps[],
+		 const unsigned nwps) {
+	if (!exportParallel(ex,wps,nwps)) {
+		gr260_export_waypoints(ex,wps,nwps*sizeof(waypoint));
+	}
+}
+
+/*** memory dumps ***/
+
+/* optional footer behind the waypoints: entries, their count and CRC,
+ * IDX_MAGIC; readers that stop at the data size never see it */
+static void dumpParseIndex(gr260_dump* const d, const char* p, const char* const end) {
+	uint32_t n, crc;
+
+	if (end-p < 16 || memcmp(end-8,IDX_MAGIC,8)) {
+		return;
+	}
+	memcpy(&n,end-16,4);
+	memcpy(&crc,end-12,4);
+	if (n > (size_t)(end-p-16)/sizeof(idxentry)) {
+		return;
+	}
+	p = end-16-n*sizeof(idxentry);
+	if (crc32Update(0,p,n*sizeof(idxentry)) != crc) {
+		return;
+	}
+	d->index = (const idxentry*)p;
+	d->nindex = n;
+}
+
+/* size/checksum header, tracklist, size/checksum header, waypoints,
+ * optional index; a truncated dump yields whatever records are complete */
+static gr260_dump* dumpParse(gr260_dump* const d) {
+	const char* p = d->base;
+	const char* const end = d->base+d->len;
+	int32_t size;
+
+	if (end-p < 8) {
+		return d;
+	}
+	memcpy(&size,p,4);
+	memcpy(&d->tlchksum,p+4,4);
+	p += 8;
+	if (size < 0 || size > end-p) {
+		size = end-p;
+	}
+	d->tracks = (const trackinfo*)p;
+	d->ntracks = size/sizeof(trackinfo);
+	p += size;
+	if (end-p < 8) {
+		return d;
+	}
+	memcpy(&size,p,4);
+	memcpy(&d->chksum,p+4,4);
+	p += 8;
+	if (size < 0 || size > end-p) {
+		size = end-p;
+	}
+	d->wps = (const waypoint*)p;
+	d->nwps = size/sizeof(waypoint);
+	dumpParseIndex(d,p+size,end);
+	return d;
+}
+
+/* appends the index footer to a complete dump open for reading and
+ * writing, nothing is done for an empty track list; a -t dump has no
+ * track list section at all and would be misread, the caller skips it */
+int dumpWriteIndex(const int fd) {
+	struct stat st;
+	const gr260_dump* d;
+	idxentry* ents;
+	uint32_t trailer[2];
+	void* base;
+	size_t i;
+	int rv = 0;
+
+	if (fstat(fd,&st) < 0) {
+		return -1;
+	}
+	base = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+	d = gr260_dump_from_memory(base,st.st_size);
+	if (d && d->ntracks && !d->index
+	    && (ents = calloc(d->ntracks,sizeof(idxentry)))) {
+		for (i = 0; i < d->ntracks; i++) {
+			const size_t first = MIN(d->tracks[i].start_addr,d->nwps);
+			const size_t n = MIN(d->tracks[i].size,d->nwps-first);
+
+			ents[i].tracknum = i+1;
+			ents[i].timestamp = d->tracks[i].timestamp;
+			ents[i].first = first;
+			ents[i].count = n;
+			ents[i].crc = crc32Update(0,d->wps+first,n*sizeof(waypoint));
+		}
+		trailer[0] = d->ntracks;
+		trailer[1] = crc32Update(0,ents,d->ntracks*sizeof(idxentry));
+		if (pwrite(fd,ents,d->ntracks*sizeof(idxentry),st.st_size) < 0
+		    || pwrite(fd,trailer,sizeof(trailer),st.st_size+d->ntracks*sizeof(idxentry)) < 0
+		    || pwrite(fd,IDX_MAGIC,8,st.st_size+d->ntracks*sizeof(idxentry)+sizeof(trailer)) < 0) {
+			rv = -1;
+		}
+		free(ents);
+	}
+	gr260_dump_close((gr260_dump*)d);
+	munmap(base,st.st_size);
+	return rv;
+}
+
+gr260_dump* gr260_dump_open(const char path[]) {
+	gr260_dump* d;
+	struct stat st;
+	void* base = NULL;
+	int fd = open(path,O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd,&st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size > 0) {
+		base = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if (base == MAP_FAILED) {
+			close(fd);
+			return NULL;
+		}
+		madvise(base,st.st_size,MADV_SEQUENTIAL);
+	}
+	close(fd);
+	d = calloc(1,sizeof(gr260_dump));
+	if (!d) {
+		if (base) {
+			munmap(base,st.st_size);
+		}
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (isManifest(base,st.st_size)) { /* pull from a block store */
+		d->buf = manifestLoad(path,base,st.st_size,&d->len);
+		munmap(base,st.st_size);
+		if (!d->buf) {
+			free(d);
+			return NULL;
+		}
+		d->base = d->buf;
+		return dumpParse(d);
+	}
+	d->base = base;
+	d->len = st.st_size;
+	d->mapped = 1;
+	return dumpParse(d);
+}
+
+gr260_dump* gr260_dump_from_memory(const void* buf, size_t len) {
+	gr260_dump* d = calloc(1,sizeof(gr260_dump));
+
+	if (!d) {
+		return NULL;
+	}
+	d->base = buf;
+	d->len = len;
+	return dumpParse(d);
+}
+
+void gr260_dump_close(gr260_dump* d) {
+	if (d && d->mapped && d->len) {
+		munmap((void*)d->base,d->len);
+	}
+	if (d) {
+		free(d->buf);
+	}
+	free(d);
+}
+
+size_t gr260_dump_track_count(const gr260_dump* d) {
+	return d->ntracks;
+}
+
+const gr260_trackinfo* gr260_dump_tracks(const gr260_dump* d) {
+	return d->tracks;
+}
+
+size_t gr260_dump_waypoint_count(const gr260_dump* d) {
+	return d->nwps;
+}
+
+const gr260_waypoint* gr260_dump_waypoints(const gr260_dump* d) {
+	return d->wps;
+}
+
+size_t gr260_dump_track_waypoints(const gr260_dump* d, size_t idx,
+				  const gr260_waypoint** first) {
+	size_t start;
+
+	if (idx < d->nindex) { /* checked against nwps when written */
+		*first = d->wps+MIN(d->index[idx].first,d->nwps);
+		return MIN(d->index[idx].count,d->nwps-(*first-d->wps));
+	}
+	if (idx >= d->ntracks) {
+		*first = NULL;
+		return 0;
+	}
+	start = MIN(d->tracks[idx].start_addr,d->nwps);
+	*first = d->wps+start;
+	return MIN(d->tracks[idx].size,d->nwps-start);
+}
+
+int gr260_dump_track_check(const gr260_dump* d, size_t idx) {
+	const gr260_waypoint* first;
+	size_t n;
+
+	if (idx >= d->nindex) {
+		return 1;
+	}
+	n = gr260_dump_track_waypoints(d,idx,&first);
+	return crc32Update(0,first,n*sizeof(waypoint)) == d->index[idx].crc ? 0 : -1;
+}
+
+/*** public wrappers ***/
+
+unsigned gr260_abi_version(void) {
+	return GR260_ABI_VERSION;
+}
+
+int gr260_send_message(int fd, const char cmd[]) {
+	return send_message(fd,cmd);
+}
+
+void gr260_set_commlog(FILE* f) {
+	gCommDump = f;
+}
+
+gr260_export* gr260_export_new(void) {
+	return calloc(1,sizeof(gr260_export));
+}
+
+int gr260_export_add_sink(gr260_export* ex, const char fmt[],
+			  const char path[]) {
+	struct sink* s;
+
+	if (sinkOpen(&ex->sinks,fmt,path,ex->usealtbar) < 0) {
+		return -1;
+	}
+	for (s = ex->sinks; s->next; s = s->next)
+		;
+	s->rowgroup = ex->rowgroup;
+	s->usedem = ex->dem != NULL;
+	strcpy(s->model,ex->model);
+	s->fwver = ex->fwver;
+	return 0;
+}
+
+void gr260_export_set_altbar(gr260_export* ex, int on) {
+	struct sink* s;
+
+	ex->usealtbar = on;
+	for (s = ex->sinks; s; s = s->next) {
+		s->usealtbar = on;
+	}
+}
+
+int gr260_export_set_dem(gr260_export* ex, const char dir[]) {
+	struct stat st;
+	struct sink* s;
+
+	if (dir && stat(dir,&st) < 0) {
+		return -1;
+	}
+	if (dir && !S_ISDIR(st.st_mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	demClose(ex->dem);
+	ex->dem = dir ? demOpen(dir) : NULL;
+	for (s = ex->sinks; s; s = s->next) {
+		s->usedem = ex->dem != NULL;
+	}
+	return 0;
+}
+
+void gr260_export_set_rowgroup(gr260_export* ex, unsigned rows) {
+	struct sink* s;
+
+	ex->rowgroup = rows;
+	for (s = ex->sinks; s; s = s->next) {
+		s->rowgroup = rows;
+	}
+}
+
+void gr260_export_set_device(gr260_export* ex, const char model[],
+			     unsigned fwver) {
+	struct sink* s;
+
+	snprintf(ex->model,sizeof(ex->model),"%s",model);
+	ex->fwver = fwver;
+	for (s = ex->sinks; s; s = s->next) {
+		strcpy(s->model,ex->model);
+		s->fwver = fwver;
+	}
+}
+
+void gr260_export_tracklist(gr260_export* ex, const void* buf, size_t len) {
+	exportTracklist(ex,buf,len);
+}
+
+/* fed in device sized blocks, like during download */
+void gr260_export_waypoints(gr260_export* ex, const void* buf, size_t len) {
+	size_t off;
+
+	for (off = 0; off < len; off += BLOCK_SIZE) {
+		dumpWaypoints(ex,(const char*)buf+off,MIN(len-off,BLOCK_SIZE));
+	}
+}
+
+void gr260_export_set_threads(gr260_export* ex, unsigned n) {
+	ex->nthreads = n;
+}
+
+void gr260_export_track(gr260_export* ex, const gr260_dump* d, size_t idx) {
+	const gr260_waypoint* first;
+	const size_t n = gr260_dump_track_waypoints(d,idx,&first);
+
+	if (idx >= d->ntracks || ex->started) {
+		return;
+	}
+	trackListPrepend((const char*)&d->tracks[idx],sizeof(trackinfo),&ex->tracklist);
+	ex->tracklist->num = idx+1;
+	sinksTrackInfo(ex->sinks,ex->tracklist,ex->tracklist->prev);
+	ex->wpbase = first-d->wps;
+	ex->trackbase = idx+1;
+	gr260_export_waypoints(ex,first,n*sizeof(waypoint));
+}
+
+void gr260_export_dump(gr260_export* ex, const gr260_dump* d) {
+	gr260_export_tracklist(ex,d->tracks,d->ntracks*sizeof(trackinfo));
+	exportImage(ex,d->wps,d->nwps);
+}
+
+void gr260_export_close(gr260_export* ex) {
+	sinksClose(ex->sinks,ex->started,ex->poilist);
+	freePOIs(ex->poilist);
+	freeTracks(ex->tracklist);
+	wpcolsFree(&ex->cols);
+	demClose(ex->dem);
+	free(ex);
+}
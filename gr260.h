@@ -0,0 +1,182 @@
+#ifndef GR260_H
+#define GR260_H
+/* libgr260 - downloading and decoding of Holux GR260 / GPSport260
+ * memory dumps
+ *
+ * Records are returned as pointers into the caller's buffer or the
+ * mmap'd dump, nothing is copied.  Only the functions and structures
+ * below are part of the ABI, GR260_ABI_VERSION is bumped on any
+ * incompatible change. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GR260_ABI_VERSION 1
+
+#if defined(__GNUC__) && defined(GR260_BUILD)
+#define GR260_API __attribute__((visibility("default")))
+#else
+#define GR260_API
+#endif
+
+typedef struct gr260_trackinfo { /* sizeof == 64B, as stored on device */
+	uint32_t unk0;
+	char name[12];
+	uint32_t timestamp; /* seconds since 1 Jan 2000 */
+	uint32_t duration; /* in s */
+	uint32_t length; /* in m */
+	uint32_t start_addr; /* index of first waypoint */
+	uint32_t size; /* number of waypoints */
+	uint16_t unk1;
+	uint16_t unk2;
+	uint16_t unk3;
+	uint16_t unk4;
+	uint32_t unk5;
+	uint32_t unk6;
+	uint32_t unk7;
+	uint32_t unk8;
+	uint32_t unk9;
+} gr260_trackinfo;
+
+typedef struct gr260_waypoint { /* sizeof == 32B, as stored on device */
+	uint32_t timestamp; /* seconds since 1 Jan 2000 */
+	float lat;
+	float lon;
+	uint16_t altgps; /* altitude in m */
+	uint16_t speed; /* in tenths of km/h */
+/* { 7, 2, "DSTA" },
+   { 8, 4, "DAGE" },
+   { 9, 2, "PDOP" },
+   { 10, 2, "HDOP"},
+   { 11, 2, "VDOP"},
+   { 12, 2, "NSAT (USED/VIEW)"},
+   { 13, 4, "SID",},
+   { 15, 2, "AZIMUTH" },
+   { 16, 2, "SNR"},
+   { 17, 2, "RCR"},
+   { 18, 2, "MILLISECOND"}, */
+	uint8_t unk1;
+	uint8_t unk2 :4;
+	uint8_t is_poi :4;
+	uint16_t hbr;    /* heartbeat rate */
+	uint16_t altbar; /* barimetric altitude in m */
+	uint16_t heading; /* heding azimuth in degrees */
+	uint32_t dist; /* distance travelled in m */
+	uint32_t unk7;
+} gr260_waypoint;
+
+#define GR260_TS_OFFSET 946684800 /* add to timestamps to get unix time */
+
+GR260_API unsigned gr260_abi_version(void);
+
+/*** protocol ***/
+
+/* sends $<cmd>*<xor>\r\n, returns write()'s result */
+GR260_API int gr260_send_message(int fd, const char cmd[]);
+/* communication log, NULL disables it */
+GR260_API void gr260_set_commlog(FILE* f);
+
+#define GR260_BLOCK_SIZE 2048 /* largest block of a transfer */
+
+typedef struct gr260_session gr260_session;
+
+/* handshake on a serial port opened O_RDWR|O_NOCTTY (model, firmware,
+ * 921600 baud, track count); the fd stays the caller's.  NULL with
+ * errno on error: ETIMEDOUT if the device doesn't answer, ENODEV or EIO
+ * when it went away, EINTR on a signal, as for the calls below. */
+GR260_API gr260_session* gr260_session_open(int fd);
+GR260_API const char* gr260_session_model(const gr260_session* s);
+GR260_API unsigned gr260_session_firmware(const gr260_session* s); /* 201 is 2.01 */
+GR260_API unsigned gr260_session_track_count(const gr260_session* s);
+/* start a transfer of the track list, or of waypoints from index from
+ * up to to; size and checksum are as the device announces them.
+ * Returns 0, or -1 with errno. */
+GR260_API int gr260_session_tracklist(gr260_session* s, uint32_t* size,
+				      uint32_t* chksum);
+GR260_API int gr260_session_waypoints(gr260_session* s, uint32_t from, uint32_t to,
+				      uint32_t* size, uint32_t* chksum);
+/* the transfer's next block into buf (GR260_BLOCK_SIZE bytes), crc set
+ * to the device's checksum of it unless NULL; returns its length, 0
+ * after the last one, -1 with errno.  Short blocks and ones not matching
+ * the checksum (taken to be CRC-32) are asked for again; a block that
+ * comes the same twice is returned even if it doesn't match, and if no
+ * block matched before, the session stops checking. */
+GR260_API int gr260_session_next_block(gr260_session* s, void* buf, uint32_t* crc);
+/* sends $<cmd>*<xor> and waits up to 10s for a reply line, put in
+ * reply as received without \r\n; 0, or -1 with errno */
+GR260_API int gr260_session_command(gr260_session* s, const char cmd[],
+				    char reply[], size_t len);
+/* $PHLX827 and the port settings from before gr260_session_open(),
+ * unless the device is gone; frees s */
+GR260_API void gr260_session_close(gr260_session* s);
+
+/*** memory dumps (as written with gr260dl -b) ***/
+
+typedef struct gr260_dump gr260_dump;
+
+/* maps the file read-only, NULL on error (errno is set); a block
+ * store manifest (gr260dl -s) is assembled in memory instead */
+GR260_API gr260_dump* gr260_dump_open(const char path[]);
+/* uses the caller's buffer, which has to outlive the dump */
+GR260_API gr260_dump* gr260_dump_from_memory(const void* buf, size_t len);
+GR260_API void gr260_dump_close(gr260_dump* d);
+
+GR260_API size_t gr260_dump_track_count(const gr260_dump* d);
+GR260_API const gr260_trackinfo* gr260_dump_tracks(const gr260_dump* d);
+GR260_API size_t gr260_dump_waypoint_count(const gr260_dump* d);
+GR260_API const gr260_waypoint* gr260_dump_waypoints(const gr260_dump* d);
+/* waypoints of track idx (0 based), returns their count; taken from
+ * the index footer of complete -b dumps if present */
+GR260_API size_t gr260_dump_track_waypoints(const gr260_dump* d, size_t idx,
+					    const gr260_waypoint** first);
+/* 0 if track idx matches the CRC in the index, -1 if not, 1 if the
+ * dump has no index */
+GR260_API int gr260_dump_track_check(const gr260_dump* d, size_t idx);
+
+/*** export ***/
+
+typedef struct gr260_export gr260_export;
+
+GR260_API gr260_export* gr260_export_new(void);
+/* fmt is one of txt, gpx, csv, geojson, kml, tcx, ndjson, fit, arrow,
+ * parquet, lod and, if built with sqlite3, sqlite; path "-" is stdout, for
+ * fit, arrow and parquet it is a directory, for sqlite the database
+ * that is added to.  gpx also takes "append:<file>": only points newer
+ * than the last one in <file> are added to it.  Returns 0 on success. */
+GR260_API int gr260_export_add_sink(gr260_export* ex, const char fmt[],
+				    const char path[]);
+GR260_API void gr260_export_set_altbar(gr260_export* ex, int on);
+/* altitude from the SRTM .hgt tiles in dir (N49E019.hgt...), for every
+ * output, instead of altgps/altbar; altgps where there is no tile or data.
+ * NULL turns it off.  Returns -1 with errno if dir isn't a directory. */
+GR260_API int gr260_export_set_dem(gr260_export* ex, const char dir[]);
+/* threads used by gr260_export_dump() for txt, gpx and csv, 0 (default)
+ * is one per cpu, 1 disables it; the output is the same either way */
+GR260_API void gr260_export_set_threads(gr260_export* ex, unsigned n);
+/* rows per arrow record batch / parquet row group, 0 is 65536 */
+GR260_API void gr260_export_set_rowgroup(gr260_export* ex, unsigned rows);
+/* model and firmware version ($PHLX852/$PHLX861) for the device table */
+GR260_API void gr260_export_set_device(gr260_export* ex, const char model[],
+				       unsigned fwver);
+/* feeds raw trackinfo / waypoint records, in device order */
+GR260_API void gr260_export_tracklist(gr260_export* ex, const void* buf,
+				      size_t len);
+GR260_API void gr260_export_waypoints(gr260_export* ex, const void* buf,
+				      size_t len);
+GR260_API void gr260_export_dump(gr260_export* ex, const gr260_dump* d);
+/* only track idx (0 based), instead of gr260_export_dump() */
+GR260_API void gr260_export_track(gr260_export* ex, const gr260_dump* d,
+				  size_t idx);
+/* finishes all outputs and frees ex */
+GR260_API void gr260_export_close(gr260_export* ex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
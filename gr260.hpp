@@ -0,0 +1,189 @@
+#ifndef GR260_HPP
+#define GR260_HPP
+/* C++ wrapper for libgr260, header only
+ *
+ *	gr260::Dump d("memdump.bin");
+ *	for (const gr260_trackinfo& ti : d.tracks())
+ *		for (const gr260_waypoint& wp : d.waypoints(&ti - d.tracks().begin()))
+ *			...
+ *
+ * Ranges point into the mapping and are valid while the Dump lives.
+ *
+ *	gr260::Session s(fd);
+ *	s.waypoints(0,end);
+ *	while (std::size_t n = s.next(buf))
+ *		...
+ *
+ * downloads over a serial port opened by the caller. */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "gr260.h"
+
+namespace gr260 {
+
+template<typename T> class Range {
+public:
+	Range(const T* b, std::size_t n) : b_(b), e_(b+n) {}
+	const T* begin() const { return b_; }
+	const T* end() const { return e_; }
+	std::size_t size() const { return e_-b_; }
+	bool empty() const { return b_ == e_; }
+	const T& operator[](std::size_t i) const { return b_[i]; }
+private:
+	const T* b_;
+	const T* e_;
+};
+
+class Dump {
+public:
+	explicit Dump(const std::string& path) : d_(gr260_dump_open(path.c_str())) {
+		if (!d_)
+			throw std::runtime_error(path+": "+std::strerror(errno));
+	}
+	Dump(const void* buf, std::size_t len) : d_(gr260_dump_from_memory(buf,len)) {
+		if (!d_)
+			throw std::runtime_error(std::string("dump: ")+std::strerror(errno));
+	}
+	Dump(Dump&& o) noexcept : d_(o.d_) { o.d_ = nullptr; }
+	Dump& operator=(Dump&& o) noexcept {
+		std::swap(d_,o.d_);
+		return *this;
+	}
+	Dump(const Dump&) = delete;
+	Dump& operator=(const Dump&) = delete;
+	~Dump() { gr260_dump_close(d_); }
+
+	Range<gr260_trackinfo> tracks() const {
+		return Range<gr260_trackinfo>(gr260_dump_tracks(d_),gr260_dump_track_count(d_));
+	}
+	Range<gr260_waypoint> waypoints() const {
+		return Range<gr260_waypoint>(gr260_dump_waypoints(d_),gr260_dump_waypoint_count(d_));
+	}
+	Range<gr260_waypoint> waypoints(std::size_t track) const {
+		const gr260_waypoint* first;
+		const std::size_t n = gr260_dump_track_waypoints(d_,track,&first);
+		return Range<gr260_waypoint>(first,n);
+	}
+	/* against the index footer: 0 ok, -1 damaged, 1 no index */
+	int check(std::size_t track) const { return gr260_dump_track_check(d_,track); }
+	const gr260_dump* get() const { return d_; }
+private:
+	gr260_dump* d_;
+};
+
+class Export {
+public:
+	Export() : ex_(gr260_export_new()) {
+		if (!ex_)
+			throw std::bad_alloc();
+	}
+	Export(Export&& o) noexcept : ex_(o.ex_) { o.ex_ = nullptr; }
+	Export& operator=(Export&& o) noexcept {
+		std::swap(ex_,o.ex_);
+		return *this;
+	}
+	Export(const Export&) = delete;
+	Export& operator=(const Export&) = delete;
+	~Export() { close(); }
+
+	Export& sink(const std::string& fmt, const std::string& path) {
+		if (gr260_export_add_sink(ex_,fmt.c_str(),path.c_str()) < 0)
+			throw std::runtime_error("cannot open "+fmt+" output "+path);
+		return *this;
+	}
+	Export& altbar(bool on = true) {
+		gr260_export_set_altbar(ex_,on);
+		return *this;
+	}
+	Export& dem(const std::string& dir) {
+		if (gr260_export_set_dem(ex_,dir.c_str()) < 0)
+			throw std::runtime_error("no dem directory "+dir);
+		return *this;
+	}
+	Export& threads(unsigned n) {
+		gr260_export_set_threads(ex_,n);
+		return *this;
+	}
+	Export& rowgroup(unsigned rows) {
+		gr260_export_set_rowgroup(ex_,rows);
+		return *this;
+	}
+	Export& device(const std::string& model, unsigned fwver) {
+		gr260_export_set_device(ex_,model.c_str(),fwver);
+		return *this;
+	}
+	void tracklist(const void* buf, std::size_t len) { gr260_export_tracklist(ex_,buf,len); }
+	void waypoints(const void* buf, std::size_t len) { gr260_export_waypoints(ex_,buf,len); }
+	void dump(const Dump& d) { gr260_export_dump(ex_,d.get()); }
+	void track(const Dump& d, std::size_t idx) { gr260_export_track(ex_,d.get(),idx); }
+	/* writes the trailers, also done by the destructor */
+	void close() {
+		if (ex_)
+			gr260_export_close(ex_);
+		ex_ = nullptr;
+	}
+private:
+	gr260_export* ex_;
+};
+
+class Session {
+public:
+	explicit Session(int fd) : s_(gr260_session_open(fd)) {
+		if (!s_)
+			fail("device");
+	}
+	Session(Session&& o) noexcept : s_(o.s_) { o.s_ = nullptr; }
+	Session& operator=(Session&& o) noexcept {
+		std::swap(s_,o.s_);
+		return *this;
+	}
+	Session(const Session&) = delete;
+	Session& operator=(const Session&) = delete;
+	~Session() { gr260_session_close(s_); }
+
+	std::string model() const { return gr260_session_model(s_); }
+	unsigned firmware() const { return gr260_session_firmware(s_); }
+	unsigned track_count() const { return gr260_session_track_count(s_); }
+	/* size and checksum of the transfer, as announced */
+	std::pair<std::uint32_t,std::uint32_t> tracklist() {
+		std::uint32_t size, chksum;
+		if (gr260_session_tracklist(s_,&size,&chksum) < 0)
+			fail("track list");
+		return std::make_pair(size,chksum);
+	}
+	std::pair<std::uint32_t,std::uint32_t> waypoints(std::uint32_t from, std::uint32_t to) {
+		std::uint32_t size, chksum;
+		if (gr260_session_waypoints(s_,from,to,&size,&chksum) < 0)
+			fail("waypoints");
+		return std::make_pair(size,chksum);
+	}
+	/* buf holds GR260_BLOCK_SIZE bytes, 0 after the last block */
+	std::size_t next(void* buf, std::uint32_t* crc = nullptr) {
+		const int n = gr260_session_next_block(s_,buf,crc);
+		if (n < 0)
+			fail("block");
+		return n;
+	}
+	std::string command(const std::string& cmd) {
+		char reply[128];
+		if (gr260_session_command(s_,cmd.c_str(),reply,sizeof(reply)) < 0)
+			fail(cmd.c_str());
+		return reply;
+	}
+private:
+	static void fail(const char what[]) {
+		throw std::runtime_error(std::string(what)+": "+std::strerror(errno));
+	}
+	gr260_session* s_;
+};
+
+} // namespace gr260
+
+#endif
@@ -1,362 +1,403 @@
 #include <assert.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <signal.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <unistd.h>
 #include <termios.h>
 #include <time.h>
 //#include <libusb-1.0/libusb.h>
+#include "gr260int.h"
 
-#define COMMPRINTF(...) if (gCommDump) fprintf(gCommDump,__VA_ARGS__)
-#define MIN(a,b) ((a)<(b) ? (a) : (b))
-
-typedef struct { /* sizeof(trackinfo) == 64B */
-	uint32_t unk0;
-	char name[12];
-	uint32_t timestamp;
-	uint32_t duration;
-	uint32_t length;
-	uint32_t start_addr;
-	uint32_t size;
-	uint16_t unk1;
-	uint16_t unk2;
-	uint16_t unk3;
-	uint16_t unk4;
-	uint32_t unk5;
-	uint32_t unk6;
-	uint32_t unk7;
-	uint32_t unk8;
-	uint32_t unk9;
-} trackinfo;
-
-typedef struct { /* sizeof(waypoint) == 32B */
-	uint32_t timestamp;
-	float lat;
-	float lon;
-	uint16_t altgps; /* altitude in m */
-	uint16_t speed; /* in tenths of km/h */
-/* { 7, 2, "DSTA" },
-   { 8, 4, "DAGE" },
-   { 9, 2, "PDOP" },
-   { 10, 2, "HDOP"},
-   { 11, 2, "VDOP"},
-   { 12, 2, "NSAT (USED/VIEW)"},
-   { 13, 4, "SID",},
-   { 15, 2, "AZIMUTH" },
-   { 16, 2, "SNR"},
-   { 17, 2, "RCR"},
-   { 18, 2, "MILLISECOND"}, */
-	uint8_t unk1;
-	uint8_t unk2 :4;
-	uint8_t is_poi :4;
-	uint16_t hbr;    /* heartbeat rate */
-	uint16_t altbar; /* barimetric altitude in m */
-	uint16_t heading; /* heding azimuth in degrees */
-	uint32_t dist; /* distance travelled in m */
-	uint32_t unk7;
-} waypoint;
-
-typedef enum {
-	CMD_UNKNOWN = -3,
-	CMD_QUIT = -2,
-	CMD_NONE = -1,
-	CMD_MODEL = 0,
-	CMD_FWARE,
-	CMD_START, //2
-	CMD_TRACKCNT,
-	CMD_TRACKS, //4 - better name
-	CMD_1STSIZE,
-	CMD_OFFSIZE, //6
-	CMD_BLOCK,
-	CMD_END = 8,
-	CMD_REQTDATA,
-	CMD_RETRY
-} cmd_t;
-
-struct tlist {
-	trackinfo ti;
-	unsigned num;
-	struct tlist* prev;
-};
+static int gVerbose = 1;
 
-struct plist {
-	waypoint poi;
-	struct plist* prev;
+/* received blocks are formatted by exportThread() so that slow outputs
+ * don't delay reading the port and requesting the next block;
+ * the semaphores are only used to sleep on an empty/full ring */
+#define RING_SLOTS 64 /* 128KB in flight at most */
+
+struct blockring { /* single producer, single consumer */
+	atomic_uint head; /* written by main loop */
+	atomic_uint tail; /* written by exportThread */
+	atomic_int done;
+	sem_t filled, freed;
+	unsigned stalls; /* producer waits on full ring */
+	gr260_export* ex;
+	struct {
+		int len;
+		char data[BLOCK_SIZE];
+	} slot[RING_SLOTS];
 };
 
-#define ts_offset ((23*365+7*366)*24*3600)/*946684800*/ /* 1 Jan 2000 00:00 */
-
-static const char* cmds[] = { //	answers:
-	"PHLX810", //*35		$PHLX852,GR260*3E
-	"PHLX829", //*3F		$PHLX861,201*2C - firmware version
-	"PHLX826", //*30		$PHLX859*38 - disp. usb icon
-	"PHLX701", //*3A		$PHLX601,18*1E - track count
-	"PHLX702,0,", //*00		$PHLX900,702,3*33
-		      //		$PHLX901,1152,FBFF1991*37 - 2nd line of response
-	"PHLX900,901,3", //*3E		$PHLX902,0,1152,FBFF1991*28
-	"PHLX900,902,3", //*3D		$PHLX902,30720,2048,AB690FC3*29
-	"PHLX900,902,3",//*3D		binary data (264B+165+...)
-//	"PHLX831",//*36			$PHLX863,GPSport260*74 #bye?
-	"PHLX827",
-/*9*/	"PHLX703,",//			request transmission of data between <start> and <end>
-	"PHLX900,902,2", //*3C"		request retransmission of last packet
-	NULL
-};
+static void ringPush(struct blockring* const r, const char buf[], const int len) {
+	const unsigned head = atomic_load_explicit(&r->head,memory_order_relaxed);
 
-static const char* rets[] = {
-	"$PHLX852,GR260", //*3E
-	"$PHLX861,", //201*2C //firmware version
-	"$PHLX859*38",
-	"$PHLX601,", //18*1E //number of tracks
-	"$PHLX900,702,", //3*33
-/*5*/	"$PHLX901,",
-	"$PHLX902,",
-	"$PHLX900,703,3*32",
-	NULL
-};
+	while (head-atomic_load_explicit(&r->tail,memory_order_acquire) == RING_SLOTS) {
+		r->stalls++;
+		sem_wait(&r->freed);
+	}
+	r->slot[head%RING_SLOTS].len = MIN(len,BLOCK_SIZE);
+	memcpy(r->slot[head%RING_SLOTS].data,buf,r->slot[head%RING_SLOTS].len);
+	atomic_store_explicit(&r->head,head+1,memory_order_release);
+	sem_post(&r->filled);
+}
 
-static int gVerbose = 1;
-static FILE* gCommDump = NULL;
-
-static int send_message(const int fh, const char cmd[]) {
-	char buf[32];
-	unsigned i;
-	int rv;
-	unsigned char xors = 0;
-			
-	for (i = 0;cmd[i];i++) {
-		xors ^= cmd[i];
-	}
-	i = sprintf(buf,"$%s*%02hhX\r\n",cmd,xors);
-	rv = write(fh,buf,i);
-	COMMPRINTF("$%s*%02hhX -> ",cmd,xors);
-	return rv;
+static void ringClose(struct blockring* const r) {
+	atomic_store_explicit(&r->done,1,memory_order_release);
+	sem_post(&r->filled);
 }
 
-static int send_cmd(const int fh, const cmd_t cmd, ...) {
-	char cmdbuf[32];
-	va_list vl;
-
-	va_start(vl,cmd);
-	if (cmd == CMD_TRACKS) {
-		const int trackcnt = va_arg(vl,int);
-		sprintf(cmdbuf,"%s%d",cmds[cmd],trackcnt);
-	} else if (cmd == CMD_REQTDATA) {
-		const int startaddr = va_arg(vl,int);
-		const int endaddr = va_arg(vl,int);
-		sprintf(cmdbuf,"%s%d,%d",cmds[cmd],startaddr,endaddr);
-	} else {
-		strcpy(cmdbuf,cmds[cmd]);
+static void* exportThread(void* arg) {
+	struct blockring* const r = arg;
+	unsigned tail = atomic_load_explicit(&r->tail,memory_order_relaxed);
+
+	for (;;) {
+		while (sem_wait(&r->filled) < 0)
+			;
+		if (tail == atomic_load_explicit(&r->head,memory_order_acquire)) {
+			if (atomic_load_explicit(&r->done,memory_order_acquire)) {
+				break;
+			}
+			continue;
+		}
+		dumpWaypoints(r->ex,r->slot[tail%RING_SLOTS].data,r->slot[tail%RING_SLOTS].len);
+		atomic_store_explicit(&r->tail,++tail,memory_order_release);
+		sem_post(&r->freed);
 	}
-	va_end(vl);
-	return send_message(fh,cmdbuf);
+	return NULL;
 }
 
-static int my_strcmp(const char s1[], const char s2[]) {
-	return strncmp(s1,s2,strlen(s2));
-}
+#define RECONNECT_WAIT 120 /* s */
+#define CKPT_INTERVAL 1 /* s, a crash loses no more than that */
+#define OPT_ERASE 0x100 /* long options only */
+#define OPT_TRACK 0x101
+#define OPT_ROWGROUP 0x102
+#define OPT_NOCACHE 0x103
+#define OPT_DEM 0x104
+
+/* state of a -b download, saved as <dump>.ckpt every CKPT_INTERVAL and
+ * when the transfer breaks off, so that --resume can continue there */
+struct ckpt {
+	char model[16];
+	unsigned fwver;
+	int trackcnt; /* -1 if the dump has no track list (-t) */
+	int tlsize;
+	unsigned tlchksum;
+	int endaddr;
+	int totalsize; /* as announced by $PHLX901 */
+	unsigned totalchksum;
+	int off; /* data bytes in the dump */
+};
 
-static void set_speed(const int fh, struct termios* const pterm,const speed_t speed) {
-	cfsetispeed(pterm,speed);
-	cfsetospeed(pterm,speed);
-	if (tcsetattr(fh,TCSANOW,pterm) < 0) {
-		perror("tcsetattr");
+/* the dump's blocks reach the disk before the checkpoint naming them */
+static int ckptSave(const char path[], const struct ckpt* const ck, const int dumpfd) {
+	char tmp[PATH_MAX];
+	FILE* f;
+
+	if (fdatasync(dumpfd) < 0) {
+		return -1;
+	}
+	snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+	if (!(f = fopen(tmp,"w"))) {
+		return -1;
+	}
+	fprintf(f,"model %s\nfwver %u\ntrackcnt %d\ntlsize %d\ntlchksum %08X\n"
+		  "endaddr %d\ntotalsize %d\ntotalchksum %08X\noff %d\n",
+		ck->model,ck->fwver,ck->trackcnt,ck->tlsize,ck->tlchksum,
+		ck->endaddr,ck->totalsize,ck->totalchksum,ck->off);
+	if (fflush(f) || fdatasync(fileno(f)) < 0) {
+		fclose(f);
+		unlink(tmp);
+		return -1;
 	}
+	if (fclose(f)) {
+		unlink(tmp);
+		return -1;
+	}
+	return rename(tmp,path); /* never leave a half written checkpoint */
 }
 
-static void dumpGpxHeader(FILE* f) {
-	fprintf(f,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-		"<gpx\n"
-		"  version=\"1.0\"\n"
-		"  creator=\"GPSBabel - http://www.gpsbabel.org\"\n"
-		"  xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
-		"  xmlns=\"http://www.topografix.com/GPX/1/0\"\n"
-		"  xsi:schemaLocation=\"http://www.topografix.com/GPX/1/0 "
-			"http://www.topografix.com/GPX/1/0/gpx.xsd\">\n");
+static int ckptLoad(const char path[], struct ckpt* const ck) {
+	FILE* const f = fopen(path,"r");
+	int n;
+
+	if (!f) {
+		return -1;
+	}
+	n = fscanf(f,"model %15s\nfwver %u\ntrackcnt %d\ntlsize %d\ntlchksum %X\n"
+		     "endaddr %d\ntotalsize %d\ntotalchksum %X\noff %d\n",
+		   ck->model,&ck->fwver,&ck->trackcnt,&ck->tlsize,&ck->tlchksum,
+		   &ck->endaddr,&ck->totalsize,&ck->totalchksum,&ck->off);
+	fclose(f);
+	if (n != 9 || ck->off < 0 || ck->off > ck->totalsize || ck->off%sizeof(waypoint)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
 }
 
-static void dumpTrackHeader(FILE* f,unsigned tracknum) {
-	fprintf(f,"<trk>\n"
-		"  <name>track-%d</name>\n"
-		"<trkseg>\n",tracknum);
-	//<time>2011-06-28T20:27:31Z</time>
-	//<bounds minlat=\"52.094039377\" minlon=\"20.592039437\" maxlat=\"52.310363814\" maxlon=\"21.030777570\"/>
-	//  <desc>Log every 2 sec, 0 m</desc>
-	// 
+/* checks what is on disk against $PHLX901's checksums; these are
+ * assumed to be CRC-32, which is only a guess (see TODO) */
+static int verifyDump(const int fd, const struct ckpt* const ck) {
+	char buf[16*BLOCK_SIZE];
+	const int nsec = ck->tlsize >= 0 ? 2 : 1;
+	off_t pos = 0;
+	int sec;
+
+	if (fsync(fd) < 0) {
+		perror("fsync");
+		return -1;
+	}
+	for (sec = 2-nsec; sec < 2; sec++) {
+		const int size = sec ? ck->totalsize : ck->tlsize;
+		const unsigned chksum = sec ? ck->totalchksum : ck->tlchksum;
+		uint32_t crc = 0;
+		int o, n;
+
+		pos += 8;
+		for (o = 0; o < size; o += n, pos += n) {
+			n = pread(fd,buf,MIN((int)sizeof(buf),size-o),pos);
+			if (n <= 0) {
+				perror("pread");
+				return -1;
+			}
+			crc = crc32Update(crc,buf,n);
+		}
+		if (crc != chksum) {
+			fprintf(stderr,"%s checksum %08X, device says %08X\n",
+				sec ? "data" : "track list",crc,chksum);
+			return -1;
+		}
+	}
+	return 0;
 }
 
-static void dumpTrackEnd(FILE* f) {
-	fprintf(f,"</trkseg>\n</trk>\n");
+/* erase sentence is given by the user, the real one isn't known yet;
+ * PHLX<nnn>... is taken as acknowledged by $PHLX900,<nnn>, as the
+ * transfer commands are */
+static int eraseDevice(gr260_session* const sess, const char cmd[]) {
+	char reply[128], ack[16];
+
+	fprintf(stderr,"\nerasing device memory\n");
+	if (gr260_session_command(sess,cmd,reply,sizeof(reply)) < 0) {
+		fprintf(stderr,"no reply to %s\n",cmd);
+		return -1;
+	}
+	snprintf(ack,sizeof(ack),"$PHLX900,%.3s,",cmd+4);
+	if (my_strcmp(reply,ack)) {
+		fprintf(stderr,"device replied %s, not %s..., memory may not be erased\n",
+			reply,ack);
+		return -1;
+	}
+	fprintf(stderr,"device replied %s\n",reply);
+	return 0;
 }
 
-static void dumpPOIs(FILE* f,struct plist* poilist) {
-	char tbuf[64];
-	struct plist* tmp;
-	unsigned wpnum = 0;
-
-	for (tmp = poilist; tmp; tmp = tmp->prev)
-		wpnum++;
-	while (poilist) {
-		waypoint* poi = &(poilist->poi);
-		time_t t = poi->timestamp + ts_offset;
-		struct tm* ptm = gmtime(&t);
-
-		strftime(tbuf,sizeof(tbuf),"%FT%TZ",ptm);
-		fprintf(f,"<wpt lat=\"%.7f\" lon=\"%.7f\">\n"
-			"  <ele>%d</ele>\n"
-			"  <time>%s</time>\n"
-			"  <name>WP%06d</name>\n"
-			"</wpt>\n",
-			poi->lat,poi->lon,poi->altgps,tbuf,wpnum);
-
-		wpnum--;
-		tmp = poilist->prev;
-		free(poilist);
-		poilist = tmp;
+/* header and blocks of a section of the dump, as the device sent them */
+static void storeSection(struct blockstore* const store, const char* p, const int len) {
+	int32_t size;
+	uint32_t chksum;
+	int o;
+
+	memcpy(&size,p,4);
+	memcpy(&chksum,p+4,4);
+	storeHeader(store,size,chksum);
+	for (o = 0; o < len; o += BLOCK_SIZE) {
+		storeBlock(store,p+8+o,MIN(BLOCK_SIZE,len-o),-1);
 	}
 }
 
-static void trackListPrepend(const char rbuf[], const int ridx,
-				    struct tlist** const tl) {
-	static int trackcurr = 1;
-	int i;
+/* the last track list of each model, keyed by $PHLX601's track count
+ * and $PHLX901's size and checksum; a hit skips the transfer */
+static int tlCachePath(char path[PATH_MAX], const char model[]) {
+	const char* const xdg = getenv("XDG_CACHE_HOME");
+	const char* const home = getenv("HOME");
+	char dir[PATH_MAX/2];
+	int n;
 
-	for (i = 0; i < ridx; i+= sizeof(trackinfo)) {
-		trackinfo *ti = (trackinfo*)(rbuf+i);
-		struct tlist* ntl;
+	if (!*model || strchr(model,'/')) {
+		return -1;
+	}
+	if (xdg && *xdg) {
+		n = snprintf(dir,sizeof(dir),"%s",xdg);
+	} else if (home && *home) {
+		n = snprintf(dir,sizeof(dir),"%s/.cache",home);
+	} else {
+		return -1;
+	}
+	if (n < 0 || n >= (int)sizeof(dir)) {
+		return -1;
+	}
+	mkdir(dir,0755);
+	snprintf(path,PATH_MAX,"%s/gr260",dir);
+	mkdir(path,0755);
+	snprintf(path,PATH_MAX,"%s/gr260/%s.tl",dir,model);
+	return 0;
+}
+
+/* returns the cached list if it is still what the device has */
+static char* tlCacheLoad(const char model[], const int trackcnt, const int tlsize,
+			 const unsigned tlchksum) {
+	char path[PATH_MAX];
+	int32_t key[3];
+	char* tl;
+	FILE* f;
 
-		/* prepend track list with new entry */
-		ntl = malloc(sizeof(struct tlist));
-		ntl->prev = *tl;
-		ntl->ti = *ti; /* copy data */
-		ntl->num = trackcurr++;
-		*tl = ntl;
+	if (tlsize <= 0 || tlCachePath(path,model) < 0 || !(f = fopen(path,"r"))) {
+		return NULL;
+	}
+	if (fread(key,sizeof(key),1,f) != 1 || key[0] != trackcnt || key[1] != tlsize
+	    || (unsigned)key[2] != tlchksum || !(tl = malloc(tlsize))) {
+		fclose(f);
+		return NULL;
 	}
+	if (fread(tl,tlsize,1,f) != 1) {
+		free(tl);
+		tl = NULL;
+	}
+	fclose(f);
+	return tl;
 }
 
-static void dumpTracks(const struct tlist* from,
-		       const struct tlist* const to) {
-	char tbuf[64];
+static void tlCacheSave(const char model[], const int trackcnt, const int tlsize,
+			const unsigned tlchksum, const char tl[]) {
+	const int32_t key[3] = { trackcnt, tlsize, (int32_t)tlchksum };
+	char path[PATH_MAX], tmp[PATH_MAX+4];
+	FILE* f;
 
-	if (!to) {
+	if (tlCachePath(path,model) < 0) {
 		return;
 	}
-	while (from != to) {
-		const struct tlist* tl = to;
-		while (tl->prev != from) {
-		       tl = tl->prev;
-		}
-		const trackinfo *ti = &(tl->ti);
-		time_t t = ti->timestamp + ts_offset;
-		struct tm* ptm = gmtime(&t);
-
-		strftime(tbuf,sizeof(tbuf),"%T",ptm);
-		printf("%2d: %08X %10s %s %5ds %6dm %4X@%06X"
-			" %05d %05d %05d %05d %08X %08X %03X %03X %u\n",
-			tl->num, ti->unk0,
-			ti->name[0] != '\377'?ti->name:"(none)",
-			tbuf, ti->duration, ti->length, ti->size,
-			ti->start_addr, ti->unk1, ti->unk2, ti->unk3, ti->unk4,
-			ti->unk5, ti->unk6, ti->unk7, ti->unk8, ti->unk9);
-		from = tl;
+	snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+	if (!(f = fopen(tmp,"w"))) {
+		return;
+	}
+	if (fwrite(key,sizeof(key),1,f) != 1 || fwrite(tl,tlsize,1,f) != 1) {
+		fclose(f);
+		unlink(tmp);
+		return;
+	}
+	if (fclose(f) || rename(tmp,path) < 0) {
+		unlink(tmp);
 	}
 }
 
-static void dumpWaypoints(FILE* f,const char rbuf[], const int len,
-			  const int gpxmode, int* const gpxheader,
-			  struct tlist* const tl, struct plist** const pl,
-			  const int usealtbar) {
-	static unsigned wpnum,tracknum;
-	struct tlist* itl;
-	int i;
-
-	for (i = 0; i < len; i+= sizeof(waypoint)) {
-		waypoint *wp = (waypoint*)(rbuf+i);
-		time_t t = wp->timestamp + ts_offset;
-		struct tm* ptm = gmtime(&t);
-		char tbuf[64];
-					      
-		if (wp->is_poi) {
-			struct plist *newpoi = malloc(sizeof(struct plist));
-			newpoi->prev = *pl;
-			newpoi->poi = *wp;
-			(*pl) = newpoi;
+/* cuts the dump back to the last checkpointed block and feeds what is
+ * there to the outputs, so they come out as if nothing had happened */
+static int resumeDump(const int fd, const struct ckpt* const ck, gr260_export* const ex,
+		      struct blockstore* const store, const int verbose) {
+	const off_t tlen = ck->tlsize >= 0 ? 8+ck->tlsize : 0;
+	const off_t len = tlen+8+ck->off;
+	char* base;
+
+	if (lseek(fd,0,SEEK_END) < len) {
+		errno = EINVAL; /* shorter than the checkpoint says */
+		return -1;
+	}
+	if (ftruncate(fd,len) < 0 || lseek(fd,len,SEEK_SET) < 0) {
+		return -1;
+	}
+	base = mmap(NULL,len,PROT_READ,MAP_SHARED,fd,0);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+	if (ck->tlsize >= 0) {
+		gr260_export_tracklist(ex,base+8,ck->tlsize);
+		if (verbose) {
+			dumpTracks(NULL,ex->tracklist);
 		}
-		if (!gpxmode) {
-			strftime(tbuf,sizeof(tbuf),"%F_%T",ptm);
-			printf("%2d: %s %8.6f %8.6f %3d %2d %3u %2u %1d %5d %5d %5d %5d %u\n",
-			       i/sizeof(waypoint)+1, tbuf, wp->lat, wp->lon,
-			       wp->altgps, (wp->speed+5)/10, wp->unk1, wp->unk2, wp->is_poi, wp->hbr,
-			       wp->altbar, wp->heading, wp->dist, wp->unk7);
-		} else {
-			if (!*gpxheader) {
-				dumpGpxHeader(f);
-				*gpxheader = 1;
-				wpnum = 0;
-				tracknum = 1;
-				dumpTrackHeader(f,tracknum);
-			}
-			for (itl = tl; itl; itl = itl->prev) {
-				if (itl->ti.start_addr <= wpnum) {
-					break;
-				}
-			}
-			if (itl && itl->num != tracknum) {
-				dumpTrackEnd(f);
-				tracknum++;
-				dumpTrackHeader(f,tracknum);
-			}
-			strftime(tbuf,sizeof(tbuf),"%FT%TZ",ptm);
-			fprintf(f,"<trkpt lat=\"%.7f\" lon=\"%.7f\">\n"
-				"  <ele>%d</ele>\n"
-				"  <time>%s</time>\n"
-				"  <course>%d</course>\n"
-				"  <speed>%.6f</speed>\n",
-				wp->lat,wp->lon,usealtbar ? wp->altbar : wp->altgps,
-				tbuf,wp->heading,wp->speed/36.);
-			if (wp->hbr) {
-				fprintf(f,"  <extensions>\n"
-					"    <gpxtpx:TrackPointExtension>\n"
-					"    <gpxtpx:hr>%d</gpxtpx:hr>\n"
-					"    </gpxtpx:TrackPointExtension>\n"
-					"  </extensions>\n",wp->hbr);
-			}
-			fprintf(f,"</trkpt>\n");
-			wpnum ++;
+	}
+	gr260_export_waypoints(ex,base+tlen+8,ck->off);
+	if (store) { /* the manifest has to describe the whole pull */
+		if (ck->tlsize >= 0) {
+			storeSection(store,base,ck->tlsize);
 		}
+		storeSection(store,base+tlen,ck->off);
 	}
+	munmap(base,len);
+	return 0;
 }
 
-int main(const int argc, char* argv[]) {
-	fd_set fds;
-	FILE *gpxf = NULL;
-	char rbuf[4*512+512]; //2KB is max anyway
-	struct termios nterm,oterm;
-	struct timeval tv;
-	struct tlist *tracklist = NULL;
-	struct plist* poilist = NULL;
-	cmd_t nextcmd = CMD_MODEL;
-	int i, rv, hin = -1, hdump = -1, ridx = 0, trackcnt=0, gpxmode = 0, gpxheader = 0;
-	int recvd = 0, hexmode = 0, usealtbar = 0;
-	int opt, expbytes = -1, endaddr = -1, totalsize = 0, hispeed = 0, listonly = 0;
-	unsigned totalchksum = 0;
-	static unsigned off = 0;
-
-	void setQuit(int __attribute__((unused)) sno) {
-		nextcmd = CMD_QUIT;
+static volatile sig_atomic_t gQuit = 0;
+
+static void setQuit(int __attribute__((unused)) sno) {
+	gQuit = 1;
+}
+
+/* the adapter re-enumerates on brown-outs and hub resets, wait for the
+ * port to come back; the caller checks it's the same device */
+static int reopenPort(const char path[]) {
+	int i, fd;
+
+	fprintf(stderr,"waiting for %s\n",path);
+	for (i = 0; i < RECONNECT_WAIT && !gQuit; i++) {
+		sleep(1);
+		fd = open(path,O_RDWR|O_NOCTTY|O_NONBLOCK);
+		if (fd >= 0) {
+			return fd;
+		}
 	}
+	return -1;
+}
+
+int main(const int argc, char* argv[]) {
+	char rbuf[GR260_BLOCK_SIZE];
+	gr260_export* const ex = gr260_export_new();
+	gr260_dump* dump = NULL;
+	static struct blockring ring;
+	pthread_t exporter;
+	sigset_t sigs;
+	gr260_session* sess = NULL;
+	int i, hin = -1, hdump = -1, trackcnt = 0;
+	int opt, endaddr = -1, listonly = 0;
+	const char* dumpname = NULL;
+	const char* devname = NULL;
+	const char* storedir = NULL;
+	struct blockstore* store = NULL;
+	uint32_t blkcrc = 0;
+	unsigned unverified = 0; /* blocks not matching their CRC */
+	time_t cksaved = 0;
+	int ckfailed = 0; /* warned about it */
+	const char* erasecmd = NULL;
+	int track = 0;
+	char ckname[PATH_MAX];
+	struct ckpt ck = { .trackcnt = -1, .tlsize = -1 };
+	int resume = 0, rc = 0;
+	int usecache = 1, devset = 0;
+	struct outspec* outs = NULL; /* -o, added once all options are read */
+	char** watchdirs = NULL;
+	unsigned nouts = 0, nwatch = 0;
+	char* tlbuf = NULL; /* the track list as it comes in, for the cache */
+	static const struct option lopts[] = {
+		{ "resume", no_argument, NULL, 'r' },
+		{ "erase-after-verify", required_argument, NULL, OPT_ERASE },
+		{ "track", required_argument, NULL, OPT_TRACK },
+		{ "row-group", required_argument, NULL, OPT_ROWGROUP },
+		{ "no-cache", no_argument, NULL, OPT_NOCACHE },
+		{ "dem", required_argument, NULL, OPT_DEM },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	if (argc < 2) {
 		goto printhelp;
 	}
-	while ((opt = getopt(argc,argv,"i:f:t:b:g:c:dvqlah")) != -1) {
+	while ((opt = getopt_long(argc,argv,"i:f:t:b:s:g:o:c:j:w:dvqlahr",lopts,NULL)) != -1) {
 		switch (opt) {
 		case 'i':
+			devname = optarg;
 			hin = open(optarg,O_RDWR|O_NOCTTY|O_NONBLOCK);
 			if (hin < 0) {
 				perror(optarg);
@@ -364,29 +405,65 @@ int main(const int argc, char* argv[]) {
 			}
 			break;
 		case 'f':
-			hin = open(optarg,O_RDWR|O_NOCTTY|O_NONBLOCK);
-			if (hin < 0) {
+			dump = gr260_dump_open(optarg);
+			if (!dump) {
 				perror(optarg);
 				return -1;
 			}
-			read(hin,&totalsize,4);
-			read(hin,&totalchksum,4);
 			break;
 		case 't':/* reads from 0 to given address */
 			endaddr = strtol(optarg,NULL,0);
 			break;
-		case 'b':{
-			hdump = open(optarg,O_WRONLY|O_CREAT,0644);
-			if (hdump < 0) {
+		case 'b':
+			dumpname = optarg; /* opened once we know about --resume */
+			break;
+		case 'r':
+			resume = 1;
+			break;
+		case 's':
+			storedir = optarg;
+			break;
+		case OPT_ERASE:
+			if (my_strcmp(optarg,"PHLX") || strlen(optarg) < 7) {
+				fprintf(stderr,"--erase-after-verify takes a sentence like PHLX999\n");
+				return 1;
+			}
+			erasecmd = optarg;
+			break;
+		case OPT_TRACK:
+			track = atoi(optarg);
+			break;
+		case OPT_ROWGROUP:
+			gr260_export_set_rowgroup(ex,atoi(optarg));
+			break;
+		case OPT_NOCACHE:
+			usecache = 0;
+			break;
+		case OPT_DEM:
+			if (gr260_export_set_dem(ex,optarg) < 0) {
 				perror(optarg);
+				return -1;
 			}
-			};break;
+			break;
 		case 'g':
-			gpxmode = 1;
-			gpxf = fopen(optarg,"w");
-			if (!gpxf) {
-				perror(optarg);
+			outs = realloc(outs,(nouts+1)*sizeof(struct outspec));
+			outs[nouts].fmt = "gpx";
+			outs[nouts++].path = optarg;
+			break;
+		case 'o':{
+			char* sep = strchr(optarg,':');
+			if (!sep) {
+				fprintf(stderr,"-o expects <format>:<file>\n");
+				return -1;
 			}
+			*sep = '\0';
+			outs = realloc(outs,(nouts+1)*sizeof(struct outspec));
+			outs[nouts].fmt = optarg;
+			outs[nouts++].path = sep+1;
+			};break;
+		case 'w':
+			watchdirs = realloc(watchdirs,(nwatch+1)*sizeof(char*));
+			watchdirs[nwatch++] = optarg;
 			break;
 		case 'q':
 			//quiet
@@ -408,231 +485,393 @@ int main(const int argc, char* argv[]) {
 			gVerbose = 2; /* we probably want to see the list */
 			break;
 		case 'a':
-			usealtbar = 1;
+			gr260_export_set_altbar(ex,1);
+			break;
+		case 'j':
+			gr260_export_set_threads(ex,atoi(optarg));
 			break;
 		case 'h':
 printhelp:
 			printf("%s\n"
 			       "\t-i</dev/ttyUSB?> read from device\n"
 			       "\t-f<memdump.bin>  read from file\n"
+			       "\t--track=<n>      only track n of -f (see -v)\n"
 			       "\t-t<end_address>  retrieve part of log\n"
 			       "\t-b<memdump.bin>  write to file\n"
+			       "\t-r, --resume     continue an interrupted -b download\n"
+			       "\t-s<dir>          keep the download in a block store,\n"
+			       "\t                 -f<dir>/<date>.man reads it back\n"
+			       "\t--erase-after-verify=<sentence>\n"
+			       "\t                 send e.g. PHLX999 once the -b dump\n"
+			       "\t                 is complete, synced and its checksums\n"
+			       "\t                 match, and expect $PHLX900,999,...\n"
+			       "\t                 back; the erase command is unknown and\n"
+			       "\t                 the checksums are assumed to be CRC-32,\n"
+			       "\t                 so a real device fails verification\n"
+			       "\t                 until that is confirmed\n"
 			       "\t-g<file.gpx>     dump in gpx format\n"
+			       "\t-o<fmt>:<file>   dump in given format (txt, gpx, csv,\n"
+			       "\t                 geojson, kml, tcx, fit, ndjson, arrow,\n"
+			       "\t                 parquet, sqlite, lod), may be repeated;\n"
+			       "\t                 fit writes <file>/track-<n>.fit, arrow\n"
+			       "\t                 and parquet <file>/{waypoints,tracks,\n"
+			       "\t                 device}.<fmt>, sqlite adds to <file>,\n"
+			       "\t                 unix:<path> connects to a unix socket,\n"
+			       "\t                 gpx:append:<file> adds newer points,\n"
+			       "\t                 lod simplifies tracks per map zoom\n"
+			       "\t--row-group=<n>  rows per arrow/parquet group (65536)\n"
+			       "\t--no-cache       always fetch the track list, which is\n"
+			       "\t                 otherwise reused while the device\n"
+			       "\t                 reports the same count, size and checksum\n"
 			       "\t-c<comm_log.txt> dump communication\n"
 			       "\t-v               be verbose (show tracklist)\n"
 			       "\t-l               list tracks only\n"
 			       "\t-a               use barimetric altitude\n"
+			       "\t--dem=<dir>      altitude from the SRTM tiles in dir\n"
+			       "\t                 (N49E019.hgt...), gps where there are none\n"
+			       "\t-j<threads>      for -f with txt/gpx/csv, default one per cpu\n"
+			       "\t-w<dir>          watch dir, may be repeated: dumps dropped\n"
+			       "\t                 there are checked, converted through the\n"
+			       "\t                 -o outputs (%%s in a path is the dump's\n"
+			       "\t                 name, required unless the output adds:\n"
+			       "\t                 sqlite, gpx:append, unix: or -) and moved\n"
+			       "\t                 to dir/done or dir/failed;\n"
+			       "\t                 -j dumps at a time\n"
 			       "\t-h               show this help\n",argv[0]);
 			return 0;
 		}
 	}
+	if (nwatch) {
+		static const struct outspec txt = { "txt", "-" };
+
+		rc = watchDirs(watchdirs,nwatch,nouts ? outs : &txt,nouts ? nouts : 1,
+			       ex,ex->nthreads);
+		free(watchdirs);
+		free(outs);
+		gr260_export_close(ex);
+		return rc;
+	}
+	for (i = 0; i < (int)nouts; i++) {
+		if (gr260_export_add_sink(ex,outs[i].fmt,outs[i].path) < 0) {
+			return -1;
+		}
+	}
+	free(outs);
 	close(0);
-	if (hin < 0) {
+	if (hin < 0 && !dump) {
 		abort();
 	}
-	if (totalsize > 0) { /* read from file */
-		while (totalsize > 0) {
-			const struct tlist *from = tracklist;
-			ridx = read(hin,rbuf,MIN(sizeof(rbuf),(unsigned)totalsize));
-			if (ridx < 0) {
-				perror("read");
-				break;
+	if (!ex->sinks) {
+		gr260_export_add_sink(ex,"txt","-");
+	}
+	if (dump) { /* read from file */
+		if (track > (int)gr260_dump_track_count(dump)) {
+			fprintf(stderr,"no track %d\n",track);
+			rc = 1;
+		} else if (track > 0) {
+			if (gr260_dump_track_check(dump,track-1) < 0) {
+				fprintf(stderr,"track %d doesn't match its checksum\n",track);
+				rc = 1;
 			}
-			trackListPrepend(rbuf,ridx,&tracklist);
-			totalsize -= ridx;
+			gr260_export_track(ex,dump,track-1);
+		} else {
+			gr260_export_tracklist(ex,dump->tracks,dump->ntracks*sizeof(trackinfo));
 			if (gVerbose > 1) {
-				dumpTracks(from,tracklist);
+				dumpTracks(NULL,ex->tracklist);
 			}
+			exportImage(ex,dump->wps,dump->nwps);
 		}
-		read(hin,&totalsize,4);
-		read(hin,&totalchksum,4);
-		while (totalsize > 0) {
-			ridx = read(hin,rbuf,MIN(sizeof(rbuf),(unsigned)totalsize));
-			if (ridx < 0) {
-				perror("read");
-				break;
+		goto end;
+	}
+	if (track && !dump) {
+		fprintf(stderr,"--track needs -f\n");
+		return -1;
+	}
+	if (erasecmd && !dumpname) {
+		fprintf(stderr,"--erase-after-verify needs -b\n");
+		return -1;
+	}
+	if (storedir && !(store = storeOpen(storedir))) {
+		perror(storedir);
+		return -1;
+	}
+	if (dumpname) {
+		snprintf(ckname,sizeof(ckname),"%s.ckpt",dumpname);
+		if (resume) {
+			if (ckptLoad(ckname,&ck) < 0) {
+				perror(ckname);
+				return -1;
+			}
+			hdump = open(dumpname,O_RDWR);
+			if (hdump < 0 || resumeDump(hdump,&ck,ex,store,gVerbose > 1) < 0) {
+				perror(dumpname);
+				return -1;
+			}
+			endaddr = ck.endaddr;
+			fprintf(stderr,"resuming at %d/%d\n",ck.off,ck.totalsize);
+		} else {
+			hdump = open(dumpname,O_RDWR|O_CREAT|O_TRUNC,0644);
+			if (hdump < 0) {
+				perror(dumpname);
 			}
-			dumpWaypoints(gpxf,rbuf,ridx,gpxmode,&gpxheader,tracklist,&poilist,usealtbar);
-			totalsize -= ridx;
+			unlink(ckname); /* left over from an abandoned download */
 		}
-		goto end;
 	}
 	signal(SIGINT,setQuit);
-	tcgetattr(hin,&oterm);
-	nterm = oterm;
-	cfmakeraw(&nterm);
-	set_speed(hin,&nterm,B38400);
-
-	FD_ZERO(&fds);
-	while (nextcmd != CMD_QUIT) {
-		if (nextcmd >= 0 && !recvd) {
-			if (nextcmd == CMD_TRACKS) {
-				send_cmd(hin,CMD_TRACKS,trackcnt);
-			} else if (nextcmd == CMD_REQTDATA) {
-				send_cmd(hin,CMD_REQTDATA,0,endaddr);
-			} else {
-				send_cmd(hin,nextcmd);
+	ring.ex = ex;
+	sem_init(&ring.filled,0,0);
+	sem_init(&ring.freed,0,0);
+	sigemptyset(&sigs);
+	sigaddset(&sigs,SIGINT);
+	pthread_sigmask(SIG_BLOCK,&sigs,NULL); /* inherited by the thread */
+	if ((errno = pthread_create(&exporter,NULL,exportThread,&ring))) {
+		perror("pthread_create");
+		return -1;
+	}
+	pthread_sigmask(SIG_UNBLOCK,&sigs,NULL);
+
+	while (!gQuit) {
+		uint32_t size, chksum;
+		unsigned fwver;
+		int n, o, err;
+
+		if (!(sess = gr260_session_open(hin))) {
+			if (!gQuit) {
+				perror(devname);
 			}
-			hexmode = 0;
-			//recvd = 0;
+			rc = 1;
+			break;
 		}
-		if (nextcmd == CMD_OFFSIZE || nextcmd == CMD_BLOCK) {
-			/* shorter timeout */
-			tv.tv_sec = 0;
-			tv.tv_usec = 50*1000;
-		} else {
-			tv.tv_sec = 2;
-			tv.tv_usec = 0;
+		fprintf(stderr,"%s found.\n",gr260_session_model(sess));
+		fwver = gr260_session_firmware(sess);
+		fprintf(stderr,"Firmware version: %u.%02u\n",fwver/100,fwver%100);
+		if (!resume) {
+			snprintf(ck.model,sizeof(ck.model),"%s",gr260_session_model(sess));
+			ck.fwver = fwver;
+		} else if (strcmp(gr260_session_model(sess),ck.model)) {
+			fprintf(stderr,"dump is from a %s, not resuming\n",ck.model);
+			rc = 1;
+			break;
+		} else if (fwver != ck.fwver) {
+			fprintf(stderr,"firmware changed, not resuming\n");
+			rc = 1;
+			break;
+		}
+		if (!devset) { /* before the first block reaches the export thread */
+			gr260_export_set_device(ex,ck.model,ck.fwver);
+			devset = 1;
 		}
-		FD_SET(hin,&fds);
-		rv = select(hin+1,&fds,NULL,NULL,&tv);
-		//printf("select:%d ridx:%d recvd:%d nextcmd:%d hexmode:%d\n",rv,ridx,recvd,nextcmd,hexmode);
-		if (rv > 0 && FD_ISSET(hin,&fds)) {
-			recvd = 1;
-			i = read(hin,rbuf+ridx,sizeof(rbuf)-ridx);
-			if (i < 0) {
-				perror("read");
-				//goto retry
-				abort();
+		trackcnt = gr260_session_track_count(sess);
+		if (resume && ck.trackcnt >= 0 && trackcnt != ck.trackcnt) {
+			fprintf(stderr,"track count changed, not resuming\n");
+			rc = 1;
+			break;
+		}
+		if (endaddr < 0) { /* the track list first, unless -t or resuming */
+			ck.trackcnt = trackcnt;
+			if (!trackcnt) {
+				fprintf(stderr,"no tracks\n");
+				break;
+			}
+			if (gr260_session_tracklist(sess,&size,&chksum) < 0) {
+				goto failed;
 			}
-			ridx += i;
-			if (ridx == expbytes) { /* don't wait for timeout */
-				goto dumpdata;
+			ck.tlsize = size;
+			ck.tlchksum = chksum;
+			if (hdump >= 0) {
+				write(hdump,&ck.tlsize,sizeof(ck.tlsize));
+				write(hdump,&ck.tlchksum,sizeof(ck.tlchksum));
 			}
-			int j, ir = 0;
-			for (ir = ridx-i; ir < ridx; ir++) {
-				unsigned char c = rbuf[ir];
-			if (c >= 32 && c < 127 && !hexmode) {
-				COMMPRINTF("%c",c);
-			} else if (c == '\r' && !hexmode) {
-				COMMPRINTF("\\r");
-			} else if (c == '\n' && !hexmode) {
-				for (j = ir; j >= 0; j--) {
-					if (rbuf[j] == '$')
-						break;
+			if (store) {
+				storeHeader(store,size,chksum);
+			}
+			tlbuf = usecache ? tlCacheLoad(ck.model,trackcnt,size,chksum) : NULL;
+			if (tlbuf) { /* as if it had been sent */
+				if (hdump >= 0) {
+					write(hdump,tlbuf,size);
 				}
-				if (j < 0) {
-					goto skip;
+				for (o = 0; store && o < (int)size; o += BLOCK_SIZE) {
+					storeBlock(store,tlbuf+o,MIN(BLOCK_SIZE,(int)size-o),-1);
 				}
-				recvd = 0;
-				if (!my_strcmp(rbuf,rets[CMD_MODEL])) {
-					fprintf(stderr,"GR260 found.\n");
-					nextcmd = CMD_FWARE;
-				} else if (!my_strcmp(rbuf,rets[CMD_FWARE])) {
-					unsigned fwver = atoi(rbuf+strlen(rets[CMD_FWARE]));
-					fprintf(stderr,"Firmware version: %u.%02u\n",fwver/100,fwver%100);
-					nextcmd = CMD_START;
-				} else if (!my_strcmp(rbuf,rets[CMD_START])) {
-					if (!hispeed) {
-						set_speed(hin,&nterm,B921600);
-						hispeed = 1;
-					}
-					if (endaddr >=0) {
-						nextcmd = CMD_REQTDATA;
-					} else {
-						nextcmd = CMD_TRACKCNT;
+				exportTracklist(ex,tlbuf,size);
+				if (gVerbose > 1) {
+					dumpTracks(NULL,ex->tracklist);
+				}
+			} else {
+				if (usecache) {
+					tlbuf = malloc(size);
+				}
+				for (o = 0; (n = gr260_session_next_block(sess,rbuf,&blkcrc)) > 0; o += n) {
+					const struct tlist *from = ex->tracklist;
+
+					if (crc32Update(0,rbuf,n) != blkcrc) {
+						unverified++;
 					}
-				} else if (!my_strcmp(rbuf,rets[CMD_TRACKCNT])) {
-					sscanf(rbuf+strlen(rets[CMD_TRACKCNT]),"%d",&trackcnt);
-					nextcmd = CMD_TRACKS;
-					//printf("trackcnt %d\n",trackcnt);
-				} else if (!my_strcmp(rbuf,rets[4])) {
-					recvd = 1;
-					//nextcmd = -1;
-				} else if (!my_strcmp(rbuf,"$PHLX863,GPSport260")) {
-					nextcmd = CMD_NONE;
-				} else if (!my_strcmp(rbuf,rets[5])) {
-					nextcmd = CMD_1STSIZE; //6
-					sscanf(rbuf+strlen(rets[5]),"%d,%X*%*d",&totalsize,&totalchksum);
-					off = 0;
 					if (hdump >= 0) {
-						write(hdump,&totalsize,sizeof(totalsize));
-						write(hdump,&totalchksum,sizeof(totalchksum));
+						write(hdump,rbuf,n);
 					}
-				//} else if (!my_strcmp(rbuf,rets[7])) {
-				//	printf ("RETS7 %s\n",rets[7]);
-				//	recvd = 1;
-				} else if (!my_strcmp(rbuf+j,rets[6])) {
-					/* TODO: verify CRC */
-					int offset;
-					/*int srv =*/ sscanf(rbuf+j+strlen(rets[6]),"%d,%d,%*X*%*d",&offset,&expbytes);
-					//printf("expbytes:%d  srv:%d\n",expbytes,srv);
-					nextcmd = CMD_OFFSIZE;
-					hexmode = 1; //test
-				} else {
-					//nextcmd = -1;
-				}
-				ridx = 0;
-				COMMPRINTF("%c",c);
-			} else {
-			//	printf(" 0x%02hhX",c); fflush(stdout);
-				tv.tv_sec = 2;
-				tv.tv_usec = 0;
-				hexmode = 1;
-			}
-skip:;
-			} //for
-		} else if (!rv) { /* timeout */
-			if (recvd) {
-dumpdata:
-				COMMPRINTF("\n");
-				if (hdump >= 0) {
-					if (ridx != expbytes) {
-						COMMPRINTF("FAILED! %d!=%d\n",ridx,expbytes);
-						nextcmd = CMD_RETRY;
-						ridx = 0;
-					} else {
-						//COMMPRINTF("write(%d,%p,%d), off:%u expb:%d\n",hdump,rbuf,ridx,off,expbytes);
-						off += write(hdump,rbuf,ridx);
-						fprintf(stderr,"\r%7d/%d",off,totalsize);
+					if (store && storeBlock(store,rbuf,n,blkcrc) < 0) {
+						perror(storedir);
 					}
-				}
-				if (endaddr < 0) {
-					const struct tlist *from = tracklist;
-					trackListPrepend(rbuf,ridx,&tracklist);
+					if (hdump >= 0 || store) {
+						fprintf(stderr,"\r%7d/%d",o+n,(int)size);
+					}
+					PROBE(block_done,o+n,n);
+					if (tlbuf && o+n <= (int)size) {
+						memcpy(tlbuf+o,rbuf,n);
+					}
+					exportTracklist(ex,rbuf,n);
 					if (gVerbose > 1) {
-						dumpTracks(from,tracklist);
+						dumpTracks(from,ex->tracklist);
 					}
-				} else {
-					dumpWaypoints(gpxf,rbuf,ridx,gpxmode,&gpxheader,tracklist,&poilist,usealtbar);
 				}
-				if (nextcmd != CMD_RETRY)
-					nextcmd = CMD_OFFSIZE;
-				recvd = 0;
-				//ridx = 0; //++
-			} else if (nextcmd == CMD_OFFSIZE) {
-				if (endaddr <= 0 && tracklist && !listonly) {
-					/* TODO: test: what will happend if we try read beyond the end of data? */
-					endaddr = tracklist->ti.start_addr+tracklist->ti.size;
-					nextcmd = CMD_REQTDATA;
-
-				} else {
-					nextcmd = CMD_QUIT;
+				if (n < 0) {
+					goto failed;
+				}
+				if (tlbuf && o == (int)size) {
+					tlCacheSave(ck.model,trackcnt,size,chksum,tlbuf);
 				}
 			}
+			free(tlbuf);
+			tlbuf = NULL;
+			if (listonly || !ex->tracklist) {
+				break;
+			}
+			endaddr = ex->tracklist->ti.start_addr+ex->tracklist->ti.size;
+		}
+		if (gr260_session_waypoints(sess,resume ? ck.off/(int)sizeof(waypoint) : 0,
+					    endaddr,&size,&chksum) < 0) {
+			goto failed;
+		}
+		if (resume) {
+			/* size of the rest; the checksum isn't comparable */
+			if ((int)size != ck.totalsize-ck.off) {
+				fprintf(stderr,"device data changed, not resuming\n");
+				rc = 1;
+				break;
+			}
+		} else {
+			ck.endaddr = endaddr;
+			ck.totalsize = size;
+			ck.totalchksum = chksum;
+			ck.off = 0;
+			if (hdump >= 0) {
+				write(hdump,&ck.totalsize,sizeof(ck.totalsize));
+				write(hdump,&ck.totalchksum,sizeof(ck.totalchksum));
+			}
+			if (store) {
+				storeHeader(store,size,chksum);
+			}
+		}
+		while ((n = gr260_session_next_block(sess,rbuf,&blkcrc)) > 0) {
+			if (crc32Update(0,rbuf,n) != blkcrc) { /* taken by the session anyway */
+				unverified++;
+			}
+			if (hdump >= 0) {
+				write(hdump,rbuf,n);
+			}
+			if (store && storeBlock(store,rbuf,n,blkcrc) < 0) {
+				perror(storedir);
+			}
+			if (hdump >= 0 || store) {
+				fprintf(stderr,"\r%7d/%d",ck.off+n,ck.totalsize);
+			}
+			PROBE(block_done,ck.off+n,n);
+			ringPush(&ring,rbuf,n);
+			ck.off += n;
+			if (hdump >= 0 && time(NULL)-cksaved >= CKPT_INTERVAL) {
+				if (ckptSave(ckname,&ck,hdump) < 0 && !ckfailed++) {
+					perror(ckname);
+				}
+				cksaved = time(NULL);
+			}
+		}
+		if (!n) {
+			break;
+		}
+failed:
+		err = errno;
+		if (gQuit) { /* the checkpoint is saved below */
+			break;
+		}
+		if (err == ENODEV) {
+			fprintf(stderr,"\ndevice disconnected\n");
+		} else {
+			perror("\ndevice");
+		}
+		rc = 1;
+		if (ck.totalsize <= 0 || (err != ENODEV && err != EIO)) {
+			break;
+		}
+		/* unplugged: continue from the last block, as with --resume */
+		if (hdump >= 0 && ckptSave(ckname,&ck,hdump) < 0 && !ckfailed++) {
+			perror(ckname);
+		}
+		gr260_session_close(sess);
+		sess = NULL;
+		close(hin);
+		if ((hin = reopenPort(devname)) < 0) {
+			break;
+		}
+		rc = 0;
+		resume = 1;
+	}
+	if (erasecmd) {
+		if (rc || ck.totalsize <= 0 || ck.off < ck.totalsize) {
+			fprintf(stderr,"\ndownload incomplete, not erasing\n");
+			rc = 1;
+		} else if (ck.trackcnt < 0) {
+			fprintf(stderr,"\n-t reads only part of the memory, not erasing\n");
+			rc = 1;
+		} else if (verifyDump(hdump,&ck) < 0) {
+			fprintf(stderr,"\ndump not verified, not erasing\n");
+			rc = 1;
+		} else if (!sess || eraseDevice(sess,erasecmd) < 0) {
+			rc = 1;
+		}
+	}
+	gr260_session_close(sess);
+	if (unverified) {
+		fprintf(stderr,"\n%u blocks don't match their CRC-32, kept as sent; "
+			"the device may use another checksum\n",unverified);
+	}
+	ringClose(&ring);
+	pthread_join(exporter,NULL);
+	if (gVerbose > 1 && ring.stalls) {
+		fprintf(stderr,"\nexport fell behind %u times\n",ring.stalls);
+	}
+	if (hdump >= 0 && ck.totalsize > 0) {
+		if (ck.off >= ck.totalsize) {
+			unlink(ckname);
+			if (ck.tlsize >= 0 && dumpWriteIndex(hdump) < 0) { /* not for -t */
+				perror(dumpname);
+			}
+		} else if (ckptSave(ckname,&ck,hdump) < 0) {
+			perror(ckname);
+		} else {
+			fprintf(stderr,"\ninterrupted at %d/%d, continue with --resume\n",
+				ck.off,ck.totalsize);
+			rc = 1;
 		}
 	}
-	if (!hispeed) {
-		set_speed(hin,&nterm,B921600);
+	if (store) {
+		storeClose(store,ck.totalsize > 0 && ck.off >= ck.totalsize,gVerbose > 1);
 	}
-	send_cmd(hin,CMD_END);
-	tcsetattr(hin,TCSANOW,&oterm);
 end:
-	close(hin);
+	free(tlbuf);
+	if (hin >= 0) {
+		close(hin);
+	}
+	gr260_dump_close(dump);
 	if (hdump >= 0) {
 		close(hdump);
 	}
 	if (gCommDump) {
 		fclose(gCommDump);
 	}
-	if (gpxmode && gpxheader) {
-		dumpTrackEnd(gpxf);
-		dumpPOIs(gpxf,poilist);
-		fprintf(gpxf,"</gpx>\n");
-		fclose(gpxf);
-	}
+	gr260_export_close(ex);
 	fprintf(stderr,"\nbye!\n");
-	return 0;
+	return rc;
 }
 
 /*	//code for using usb directly
@@ -653,3 +892,4 @@ end:
 		printf("found device; sent: %d IO_ERROR:%d\n",rv,LIBUSB_ERROR_IO);
 		libusb_exit(NULL);
 	}*/
+
@@ -0,0 +1,258 @@
+/* gr260emu - pretends to be a GR260 on a pty, serving a -b dump;
+ * for testing gr260dl without a device:
+ *	gr260emu memdump.bin /tmp/gr260 & gr260dl -i /tmp/gr260 ...
+ * Checksums are CRC-32 (the device's algorithm is unknown). */
+#define _GNU_SOURCE /* posix_openpt() */
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define IDLE_EXIT 30 /* s */
+
+static const char* gErase = NULL; /* sentence that erases memory */
+
+struct emu {
+	int fd;
+	const char* tl; /* track list */
+	int tlsize;
+	const char* wps; /* waypoint data */
+	int wsize;
+	const char* data; /* current transfer */
+	int len, base, blk, inblock;
+	int pend[2]; /* $PHLX703 waiting for its $PHLX901 ack */
+	int dropafter; /* blocks, -1 never */
+	int corrupt; /* blocks until one goes out damaged, -1 never */
+	uint32_t crcxor; /* -k: block checksums other than CRC-32 */
+};
+
+static void reply(const struct emu* const e, const char fmt[], ...)
+	__attribute__((format(printf,2,3)));
+
+static void reply(const struct emu* const e, const char fmt[], ...) {
+	char body[64];
+	va_list vl;
+
+	va_start(vl,fmt);
+	vsnprintf(body,sizeof(body),fmt,vl);
+	va_end(vl);
+	send_message(e->fd,body);
+}
+
+static void blockHeader(const struct emu* const e) {
+	const int n = MIN(BLOCK_SIZE,e->len-e->blk*BLOCK_SIZE);
+
+	reply(e,"PHLX902,%d,%d,%08X",e->base+e->blk*BLOCK_SIZE,n,
+	      crc32Update(0,e->data+e->blk*BLOCK_SIZE,n)^e->crcxor);
+}
+
+/* $PHLX900,<cmd>,3 then $PHLX901,<size>,<checksum> */
+static void transfer(struct emu* const e, const int cmd, const char* data,
+		     const int len, const int base) {
+	e->data = data;
+	e->len = len;
+	e->base = base;
+	reply(e,"PHLX900,%d,3",cmd);
+	usleep(20*1000); /* separate reads, as from the device */
+	reply(e,"PHLX901,%d,%08X",len,crc32Update(0,data,len));
+}
+
+static int handle(struct emu* const e, const char line[]) {
+	int a, b;
+
+	if (!strcmp(line,"PHLX810")) {
+		reply(e,"PHLX852,GR260");
+	} else if (!strcmp(line,"PHLX829")) {
+		reply(e,"PHLX861,201");
+	} else if (!strcmp(line,"PHLX826")) {
+		reply(e,"PHLX859");
+	} else if (!strcmp(line,"PHLX827")) {
+		reply(e,"PHLX860");
+	} else if (!strcmp(line,"PHLX701")) {
+		reply(e,"PHLX601,%d",e->tlsize/(int)sizeof(trackinfo));
+	} else if (sscanf(line,"PHLX702,%d,%d",&a,&b) == 2) {
+		transfer(e,702,e->tl,e->tlsize,0);
+	} else if (sscanf(line,"PHLX703,%d,%d",&a,&b) == 2) {
+		if (a == e->pend[0] && b == e->pend[1]) {
+			return 0; /* repeated while we were answering */
+		}
+		e->pend[0] = a;
+		e->pend[1] = b;
+		a = MIN(a*(int)sizeof(waypoint),e->wsize);
+		b = MIN(b*(int)sizeof(waypoint),e->wsize);
+		transfer(e,703,e->wps+a,MAX(b-a,0),a);
+	} else if (!strcmp(line,"PHLX900,901,3")) {
+		e->pend[0] = e->pend[1] = -1;
+		e->blk = 0;
+		e->inblock = 0;
+		if (e->len > 0) {
+			blockHeader(e);
+		}
+	} else if (!strcmp(line,"PHLX900,902,3")) {
+		if (e->blk*BLOCK_SIZE >= e->len) {
+			return 0;
+		}
+		if (!e->inblock) {
+			const char* const blk = e->data+e->blk*BLOCK_SIZE;
+			const int n = MIN(BLOCK_SIZE,e->len-e->blk*BLOCK_SIZE);
+			char bad[BLOCK_SIZE];
+
+			if (!e->dropafter--) {
+				fprintf(stderr,"dropping the line\n");
+				return -1;
+			}
+			if (!e->corrupt--) {
+				fprintf(stderr,"damaging a block\n");
+				memcpy(bad,blk,n);
+				bad[n/2] ^= 0x10;
+				write(e->fd,bad,n);
+			} else {
+				write(e->fd,blk,n);
+			}
+			e->blk++;
+			e->inblock = 1;
+		} else if (e->blk*BLOCK_SIZE < e->len) {
+			blockHeader(e);
+			e->inblock = 0;
+		}
+	} else if (!strcmp(line,"PHLX900,902,2")) { /* resend */
+		if (e->inblock) {
+			e->blk--;
+		}
+		blockHeader(e);
+		e->inblock = 0;
+	} else if (!strcmp(line,"PHLX710")) {
+		reply(e,"PHLX610,1983,7000,1680");
+	} else if (gErase && !strcmp(line,gErase)) {
+		fprintf(stderr,"memory erased\n");
+		e->tlsize = 0;
+		e->wsize = 0;
+		reply(e,"PHLX900,%.3s,3",gErase+4);
+	} else {
+		fprintf(stderr,"unknown: %s\n",line);
+	}
+	return 0;
+}
+
+int main(const int argc, char* argv[]) {
+	struct emu e = { .pend = { -1, -1 }, .dropafter = -1, .corrupt = -1 };
+	char buf[256];
+	struct termios term;
+	struct stat st;
+	const char* base;
+	int32_t size;
+	int opt, fd, n = 0, idle = 0;
+
+	while ((opt = getopt(argc,argv,"e:d:c:kh")) != -1) {
+		switch (opt) {
+		case 'e':
+			gErase = optarg;
+			break;
+		case 'd':
+			e.dropafter = atoi(optarg);
+			break;
+		case 'c':
+			e.corrupt = atoi(optarg);
+			break;
+		case 'k':
+			e.crcxor = 0x5A5A5A5A;
+			break;
+		default:
+			printf("%s [-e<sentence>] [-d<n>] [-c<n>] [-k] <memdump.bin> <link>\n"
+			       "\t-e<sentence>  accept e.g. PHLX999 as erase command\n"
+			       "\t-d<n>         hang up before the n-th block\n"
+			       "\t-c<n>         damage the n-th block the first time\n"
+			       "\t-k            block checksums other than CRC-32\n",argv[0]);
+			return opt != 'h';
+		}
+	}
+	if (argc-optind != 2) {
+		fprintf(stderr,"expecting <memdump.bin> <link>\n");
+		return 1;
+	}
+	fd = open(argv[optind],O_RDONLY);
+	if (fd < 0 || fstat(fd,&st) < 0 || st.st_size < 16) {
+		perror(argv[optind]);
+		return 1;
+	}
+	base = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memcpy(&size,base,4);
+	e.tl = base+8;
+	e.tlsize = MIN(MAX(size,0),st.st_size-16);
+	memcpy(&size,e.tl+e.tlsize,4);
+	e.wps = e.tl+e.tlsize+8;
+	e.wsize = MIN(MAX(size,0),st.st_size-16-e.tlsize);
+
+	e.fd = posix_openpt(O_RDWR|O_NOCTTY);
+	if (e.fd < 0 || grantpt(e.fd) < 0 || unlockpt(e.fd) < 0) {
+		perror("posix_openpt");
+		return 1;
+	}
+	tcgetattr(e.fd,&term);
+	cfmakeraw(&term);
+	tcsetattr(e.fd,TCSANOW,&term);
+	unlink(argv[optind+1]);
+	if (symlink(ptsname(e.fd),argv[optind+1]) < 0) {
+		perror(argv[optind+1]);
+		return 1;
+	}
+	for (;;) {
+		fd_set fds;
+		struct timeval tv = { IDLE_EXIT, 0 };
+		char* nl;
+		int rv;
+
+		FD_ZERO(&fds);
+		FD_SET(e.fd,&fds);
+		if (select(e.fd+1,&fds,NULL,NULL,&tv) <= 0) {
+			break; /* nobody talks to us */
+		}
+		rv = read(e.fd,buf+n,sizeof(buf)-1-n);
+		if (rv <= 0) {
+			if (rv < 0 && errno == EIO && idle++ < IDLE_EXIT*10) {
+				usleep(100*1000); /* nobody has the pty open */
+				continue;
+			}
+			break;
+		}
+		idle = 0;
+		n += rv;
+		buf[n] = '\0';
+		while ((nl = strchr(buf,'\n'))) {
+			char* const dollar = strchr(buf,'$');
+			char* star;
+
+			*nl = '\0';
+			if (dollar && dollar < nl && (star = strchr(dollar,'*'))) {
+				*star = '\0';
+				if (handle(&e,dollar+1) < 0) {
+					goto out;
+				}
+			}
+			n -= nl+1-buf;
+			memmove(buf,nl+1,n+1);
+		}
+		if (n == sizeof(buf)-1) {
+			n = 0; /* garbage */
+		}
+	}
+out:
+	close(e.fd);
+	unlink(argv[optind+1]);
+	return 0;
+}
@@ -0,0 +1,896 @@
+/* gr260idx - time and space index over an archive of -b dumps and manifests
+ *	gr260idx -B archive.idx dump1.bin dump2.bin ...	(re)builds the index
+ *	gr260idx archive.idx 2022-03-09T20:00 2022-03-09T21:00
+ * prints all points between the two times, from all dumps, in time
+ * order.  Only the tracks overlapping the range are looked at, and
+ * within them only the blocks from the first overlapping one.
+ *	gr260idx -w 50.1,18.9,50.3,19.1 archive.idx
+ *	gr260idx -n 50.2,19.0,500 archive.idx
+ * list the tracks passing through a box and the POIs within 500m of a
+ * place, from the track bounding boxes and the point index alone. */
+#define _GNU_SOURCE /* strptime(), timegm() */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+#define TI_MAGIC "GR260TI2"
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MAX_CELLS 64 /* a box is looked up as at most this many cells */
+#define EARTH_R 6371000.0 /* m */
+#define BLOCK_WPS (BLOCK_SIZE/sizeof(waypoint))
+
+/* file: header, dumps, tracks sorted by start, blocks, points sorted
+ * by geoKey(), path strings; times are device seconds (since 2000) */
+struct tihdr {
+	char magic[8];
+	uint32_t ndumps, ntracks, nblocks, npoints, strsize;
+	uint32_t pad;
+};
+
+struct tidump {
+	uint32_t path; /* offset into the strings */
+	uint32_t pad;
+	int64_t size, mtime; /* to notice a changed file */
+};
+
+struct titrack {
+	uint32_t start, end; /* trackinfo's, widened to the waypoints' */
+	uint32_t maxend; /* of this and all earlier entries */
+	uint32_t dump, track; /* 0 based */
+	uint32_t first, count; /* waypoints */
+	uint32_t blk, nblk;
+	float lat0, lon0, lat1, lon1; /* bounding box */
+};
+
+struct tiblock { /* BLOCK_WPS waypoints of a track */
+	uint32_t tmin;
+	uint32_t tmax; /* of this and all earlier blocks of the track */
+};
+
+struct tipoint {
+	float lat, lon;
+	uint32_t track; /* in the sorted tracks */
+	uint32_t wp :31; /* in the track */
+	uint32_t is_poi :1;
+};
+
+static int gVerbose = 0;
+
+/*** building ***/
+
+struct builder {
+	struct tidump* dumps;
+	struct titrack* tracks;
+	struct tiblock* blocks;
+	struct tipoint* points;
+	char* strs;
+	uint32_t ndumps, ntracks, nblocks, npoints, strsize;
+};
+
+static void* grow(void* p, const size_t n, const size_t size) {
+	if (n & (n-1)) { /* grows at powers of two */
+		return p;
+	}
+	p = realloc(p,(n ? 2*n : 1)*size);
+	if (!p) {
+		perror("realloc");
+		exit(1);
+	}
+	return p;
+}
+
+/* interleaved bits of lon and lat, like a geohash: points in the same
+ * cell of any size are contiguous when sorted by it */
+static uint64_t spread(uint32_t v) {
+	uint64_t x = v;
+
+	x = (x | x << 16) & 0x0000FFFF0000FFFFull;
+	x = (x | x << 8) & 0x00FF00FF00FF00FFull;
+	x = (x | x << 4) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | x << 2) & 0x3333333333333333ull;
+	x = (x | x << 1) & 0x5555555555555555ull;
+	return x;
+}
+
+static uint32_t quant(const double v, const double range) {
+	const double q = (v/range+0.5)*4294967296.0;
+
+	return q < 0 ? 0 : q > UINT32_MAX ? UINT32_MAX : (uint32_t)q;
+}
+
+static uint64_t cellKey(const uint32_t qlat, const uint32_t qlon) {
+	return spread(qlon) << 1 | spread(qlat);
+}
+
+static uint64_t geoKey(const float lat, const float lon) {
+	return cellKey(quant(lat,180),quant(lon,360));
+}
+
+static int validPos(const waypoint* const wp) {
+	return isfinite(wp->lat) && isfinite(wp->lon) && fabsf(wp->lat) <= 90
+	       && fabsf(wp->lon) <= 180;
+}
+
+static int addDump(struct builder* const b, const char path[]) {
+	char full[PATH_MAX];
+	struct stat st;
+	gr260_dump* d;
+	struct tidump* td;
+	size_t i, len;
+
+	if (stat(path,&st) < 0 || !(d = gr260_dump_open(path))) {
+		perror(path);
+		return -1;
+	}
+	if (!realpath(path,full)) {
+		snprintf(full,sizeof(full),"%s",path);
+	}
+	len = strlen(full)+1;
+	if (!(b->strs = realloc(b->strs,b->strsize+len))) {
+		perror("realloc");
+		exit(1);
+	}
+	memcpy(b->strs+b->strsize,full,len);
+	b->dumps = grow(b->dumps,b->ndumps,sizeof(*b->dumps));
+	td = &b->dumps[b->ndumps];
+	td->path = b->strsize;
+	td->pad = 0;
+	td->size = st.st_size;
+	td->mtime = st.st_mtime;
+	b->strsize += len;
+
+	for (i = 0; i < d->ntracks; i++) {
+		const waypoint* wps;
+		const size_t n = gr260_dump_track_waypoints(d,i,&wps);
+		struct titrack* tt;
+		uint32_t tmax = 0;
+		size_t j;
+
+		if (!n) {
+			continue;
+		}
+		b->tracks = grow(b->tracks,b->ntracks,sizeof(*b->tracks));
+		tt = &b->tracks[b->ntracks++];
+		tt->start = d->tracks[i].timestamp;
+		tt->end = d->tracks[i].timestamp+d->tracks[i].duration;
+		tt->dump = b->ndumps;
+		tt->track = i;
+		tt->first = wps-d->wps;
+		tt->count = n;
+		tt->blk = b->nblocks;
+		tt->nblk = (n+BLOCK_WPS-1)/BLOCK_WPS;
+		tt->lat0 = tt->lon0 = INFINITY;
+		tt->lat1 = tt->lon1 = -INFINITY;
+		for (j = 0; j < n; j++) {
+			struct tiblock* tb;
+			struct tipoint* tp;
+
+			if (j%BLOCK_WPS == 0) {
+				b->blocks = grow(b->blocks,b->nblocks,sizeof(*b->blocks));
+				tb = &b->blocks[b->nblocks++];
+				tb->tmin = UINT32_MAX;
+			}
+			tb = &b->blocks[b->nblocks-1];
+			tb->tmin = MIN(tb->tmin,wps[j].timestamp);
+			if (wps[j].timestamp > tmax) {
+				tmax = wps[j].timestamp;
+			}
+			tb->tmax = tmax;
+			if (wps[j].timestamp < tt->start) {
+				tt->start = wps[j].timestamp;
+			}
+			if (!validPos(&wps[j])) {
+				continue;
+			}
+			tt->lat0 = MIN(tt->lat0,wps[j].lat);
+			tt->lon0 = MIN(tt->lon0,wps[j].lon);
+			tt->lat1 = MAX(tt->lat1,wps[j].lat);
+			tt->lon1 = MAX(tt->lon1,wps[j].lon);
+			b->points = grow(b->points,b->npoints,sizeof(*b->points));
+			tp = &b->points[b->npoints++];
+			tp->lat = wps[j].lat;
+			tp->lon = wps[j].lon;
+			tp->track = b->ntracks-1;
+			tp->wp = j;
+			tp->is_poi = !!wps[j].is_poi;
+		}
+		if (tmax > tt->end) {
+			tt->end = tmax;
+		}
+	}
+	if (gVerbose) {
+		fprintf(stderr,"%s: %zu tracks\n",full,d->ntracks);
+	}
+	gr260_dump_close(d);
+	b->ndumps++;
+	return 0;
+}
+
+static int cmpStart(const void* a, const void* b) {
+	const struct titrack* const ta = a;
+	const struct titrack* const tb = b;
+
+	if (ta->start != tb->start) {
+		return ta->start < tb->start ? -1 : 1;
+	}
+	return ta->dump != tb->dump ? (ta->dump < tb->dump ? -1 : 1)
+				    : (ta->track < tb->track ? -1 : ta->track > tb->track);
+}
+
+static int cmpGeo(const void* a, const void* b) {
+	const uint64_t ka = geoKey(((const struct tipoint*)a)->lat,((const struct tipoint*)a)->lon);
+	const uint64_t kb = geoKey(((const struct tipoint*)b)->lat,((const struct tipoint*)b)->lon);
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static int build(const char idxname[], char* const paths[], const int npaths) {
+	struct builder b = { 0 };
+	struct tihdr h;
+	char tmp[PATH_MAX+4];
+	uint32_t maxend = 0, i;
+	uint32_t* pos;
+	FILE* f;
+	int rv = 0;
+
+	for (i = 0; i < (uint32_t)npaths; i++) {
+		if (addDump(&b,paths[i]) < 0) {
+			rv = 1;
+		}
+	}
+	/* maxend holds the position before sorting, to renumber the points */
+	for (i = 0; i < b.ntracks; i++) {
+		b.tracks[i].maxend = i;
+	}
+	qsort(b.tracks,b.ntracks,sizeof(*b.tracks),cmpStart);
+	pos = malloc((b.ntracks+1)*sizeof(*pos));
+	for (i = 0; i < b.ntracks; i++) {
+		pos[b.tracks[i].maxend] = i;
+		if (b.tracks[i].end > maxend) {
+			maxend = b.tracks[i].end;
+		}
+		b.tracks[i].maxend = maxend;
+	}
+	for (i = 0; i < b.npoints; i++) {
+		b.points[i].track = pos[b.points[i].track];
+	}
+	free(pos);
+	qsort(b.points,b.npoints,sizeof(*b.points),cmpGeo);
+	memcpy(h.magic,TI_MAGIC,8);
+	h.ndumps = b.ndumps;
+	h.ntracks = b.ntracks;
+	h.nblocks = b.nblocks;
+	h.npoints = b.npoints;
+	h.strsize = b.strsize;
+	h.pad = 0;
+	snprintf(tmp,sizeof(tmp),"%s.tmp",idxname);
+	if (!(f = fopen(tmp,"w"))) {
+		perror(tmp);
+		return 1;
+	}
+	fwrite(&h,sizeof(h),1,f);
+	fwrite(b.dumps,sizeof(*b.dumps),b.ndumps,f);
+	fwrite(b.tracks,sizeof(*b.tracks),b.ntracks,f);
+	fwrite(b.blocks,sizeof(*b.blocks),b.nblocks,f);
+	fwrite(b.points,sizeof(*b.points),b.npoints,f);
+	fwrite(b.strs,1,b.strsize,f);
+	if (ferror(f) | fclose(f) || rename(tmp,idxname) < 0) {
+		perror(idxname);
+		unlink(tmp);
+		rv = 1;
+	} else if (gVerbose) {
+		fprintf(stderr,"%s: %u dumps, %u tracks, %u blocks, %u points\n",idxname,
+			b.ndumps,b.ntracks,b.nblocks,b.npoints);
+	}
+	free(b.dumps);
+	free(b.tracks);
+	free(b.blocks);
+	free(b.points);
+	free(b.strs);
+	return rv;
+}
+
+/*** querying ***/
+
+struct index {
+	const struct tihdr* h;
+	const struct tidump* dumps;
+	const struct titrack* tracks;
+	const struct tiblock* blocks;
+	const struct tipoint* points;
+	const char* strs;
+	size_t len;
+};
+
+static int indexOpen(struct index* const ix, const char path[]) {
+	const int fd = open(path,O_RDONLY);
+	struct stat st;
+	const char* p;
+
+	if (fd < 0 || fstat(fd,&st) < 0) {
+		return -1;
+	}
+	ix->len = st.st_size;
+	p = mmap(NULL,ix->len,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return -1;
+	}
+	ix->h = (const struct tihdr*)p;
+	if (ix->len < sizeof(*ix->h) || memcmp(ix->h->magic,TI_MAGIC,8)
+	    || ix->len != sizeof(*ix->h)+ix->h->ndumps*sizeof(*ix->dumps)
+			  +(size_t)ix->h->ntracks*sizeof(*ix->tracks)
+			  +(size_t)ix->h->nblocks*sizeof(*ix->blocks)
+			  +(size_t)ix->h->npoints*sizeof(*ix->points)+ix->h->strsize) {
+		munmap((void*)p,ix->len);
+		errno = EINVAL;
+		return -1;
+	}
+	ix->dumps = (const struct tidump*)(ix->h+1);
+	ix->tracks = (const struct titrack*)(ix->dumps+ix->h->ndumps);
+	ix->blocks = (const struct tiblock*)(ix->tracks+ix->h->ntracks);
+	ix->points = (const struct tipoint*)(ix->blocks+ix->h->nblocks);
+	ix->strs = (const char*)(ix->points+ix->h->npoints);
+	return 0;
+}
+
+struct cursor { /* points of one track or dump within the range */
+	const waypoint* wp;
+	const waypoint* end;
+	unsigned seq; /* keeps the merge stable */
+	const char* src; /* device tag */
+	unsigned track; /* 1 based, of wp */
+	const waypoint* trackend;
+	const gr260_dump* d; /* whole dumps: the track list to advance through */
+};
+
+/* moves track on to the one wp is in, by the dump's track list */
+static void cursorTrack(struct cursor* const c) {
+	while (c->wp >= c->trackend && c->d && c->track < gr260_dump_track_count(c->d)) {
+		const waypoint* first;
+		const size_t n = gr260_dump_track_waypoints(c->d,c->track++,&first);
+
+		c->trackend = first+n;
+	}
+}
+
+static int cursorLess(const struct cursor* const a, const struct cursor* const b) {
+	return a->wp->timestamp != b->wp->timestamp ? a->wp->timestamp < b->wp->timestamp
+						    : a->seq < b->seq;
+}
+
+static void heapDown(struct cursor h[], const unsigned n, unsigned i) {
+	for (;;) {
+		unsigned m = i, c;
+
+		for (c = 2*i+1; c <= 2*i+2 && c < n; c++) {
+			if (cursorLess(&h[c],&h[m]))
+				m = c;
+		}
+		if (m == i) {
+			return;
+		}
+		struct cursor t = h[i];
+		h[i] = h[m];
+		h[m] = t;
+		i = m;
+	}
+}
+
+/* k-way merge by timestamp of the cursors' points up to t2, each
+ * cursor being chronological; returns the number of points */
+static size_t merge(struct cursor heap[], unsigned n, const uint32_t t2,
+		    gr260_export* const ex) {
+	waypoint out[BLOCK_WPS];
+	const char* src[BLOCK_WPS];
+	unsigned srctrack[BLOCK_WPS];
+	size_t nout = 0, npts = 0;
+	unsigned i;
+
+	ex->src = src;
+	ex->srctrack = srctrack;
+	for (i = n/2; i-- > 0;) {
+		heapDown(heap,n,i);
+	}
+	while (n) {
+		cursorTrack(&heap[0]);
+		src[nout] = heap[0].src;
+		srctrack[nout] = heap[0].track;
+		out[nout++] = *heap[0].wp++;
+		if (nout == BLOCK_WPS) {
+			dumpWaypoints(ex,(const char*)out,sizeof(out));
+			npts += nout;
+			nout = 0;
+		}
+		if (heap[0].wp == heap[0].end || heap[0].wp->timestamp > t2) {
+			heap[0] = heap[--n];
+		}
+		heapDown(heap,n,0);
+	}
+	dumpWaypoints(ex,(const char*)out,nout*sizeof(waypoint));
+	ex->src = NULL;
+	ex->srctrack = NULL;
+	return npts+nout;
+}
+
+/* the file name, reduced to characters that need no quoting in any sink */
+static char* deviceTag(const char path[]) {
+	const char* const slash = strrchr(path,'/');
+	char* const tag = strdup(slash ? slash+1 : path);
+	char* p;
+
+	for (p = tag; *p; p++) {
+		if (!isalnum((unsigned char)*p) && !strchr("._-",*p))
+			*p = '_';
+	}
+	return tag;
+}
+
+/* opens the dumps lazily, checking they haven't changed since indexing */
+static gr260_dump* dumpFor(const struct index* const ix, gr260_dump* ds[],
+			   const uint32_t n) {
+	const struct tidump* const td = &ix->dumps[n];
+	const char* const path = ix->strs+td->path;
+	struct stat st;
+
+	if (!ds[n]) {
+		if (stat(path,&st) < 0) {
+			perror(path);
+			return NULL;
+		}
+		if (st.st_size != td->size || st.st_mtime != td->mtime) {
+			fprintf(stderr,"%s changed since indexing, skipped\n",path);
+			return NULL;
+		}
+		ds[n] = gr260_dump_open(path);
+		if (!ds[n]) {
+			perror(path);
+		}
+	}
+	return ds[n];
+}
+
+/* the points of all dumps from t1 to t2 in time order, then closes ex */
+static int query(const struct index* const ix, const uint32_t t1, const uint32_t t2,
+		 gr260_export* const ex) {
+	const struct titrack* const tr = ix->tracks;
+	gr260_dump** const ds = calloc(ix->h->ndumps,sizeof(gr260_dump*));
+	char** const tags = calloc(ix->h->ndumps,sizeof(char*));
+	struct cursor* const heap = calloc(ix->h->ntracks+1,sizeof(struct cursor));
+	size_t lo, hi, a, z, npts;
+	unsigned n = 0, i;
+
+	/* [lo,hi): maxend >= t1 and start <= t2, both are sorted */
+	for (a = 0, z = ix->h->ntracks; a < z;) {
+		const size_t m = a+(z-a)/2;
+		if (tr[m].maxend < t1) a = m+1; else z = m;
+	}
+	lo = a;
+	for (z = ix->h->ntracks; a < z;) {
+		const size_t m = a+(z-a)/2;
+		if (tr[m].start <= t2) a = m+1; else z = m;
+	}
+	hi = a;
+	for (i = lo; i < hi; i++) {
+		const struct tiblock* const bl = ix->blocks+tr[i].blk;
+		const gr260_dump* d;
+		const waypoint* wp;
+		const waypoint* end;
+
+		if (tr[i].end < t1 || !(d = dumpFor(ix,ds,tr[i].dump))) {
+			continue;
+		}
+		if (tr[i].first+tr[i].count > d->nwps) {
+			continue;
+		}
+		/* first block reaching t1, tmax is monotonic within a track */
+		for (a = 0, z = tr[i].nblk; a < z;) {
+			const size_t m = a+(z-a)/2;
+			if (bl[m].tmax < t1) a = m+1; else z = m;
+		}
+		wp = d->wps+tr[i].first+a*BLOCK_WPS;
+		end = d->wps+tr[i].first+tr[i].count;
+		while (wp < end && wp->timestamp < t1) {
+			wp++;
+		}
+		if (gVerbose) {
+			fprintf(stderr,"%s track %u, from block %zu of %u\n",
+				ix->strs+ix->dumps[tr[i].dump].path,tr[i].track+1,a,tr[i].nblk);
+		}
+		if (wp < end && wp->timestamp <= t2) {
+			if (!tags[tr[i].dump]) {
+				tags[tr[i].dump] = deviceTag(ix->strs+ix->dumps[tr[i].dump].path);
+			}
+			heap[n].wp = wp;
+			heap[n].end = end;
+			heap[n].seq = i;
+			heap[n].src = tags[tr[i].dump];
+			heap[n].track = tr[i].track+1;
+			heap[n].trackend = end;
+			n++;
+		}
+	}
+	npts = merge(heap,n,t2,ex);
+	gr260_export_close(ex); /* the last track's end still names its dump */
+	if (gVerbose) {
+		fprintf(stderr,"%zu points\n",npts);
+	}
+	for (i = 0; i < ix->h->ndumps; i++) {
+		gr260_dump_close(ds[i]);
+		free(tags[i]);
+	}
+	free(ds);
+	free(tags);
+	free(heap);
+	return 0;
+}
+
+/* merges whole dumps, which only costs a cursor per dump; the kernel
+ * drops the mapped pages behind it.  Closes ex. */
+static int mergeDumps(char* const paths[], const int npaths, gr260_export* const ex) {
+	gr260_dump** const ds = calloc(npaths+1,sizeof(gr260_dump*));
+	char** const tags = calloc(npaths+1,sizeof(char*));
+	struct cursor* const heap = calloc(npaths+1,sizeof(struct cursor));
+	size_t npts;
+	unsigned n = 0;
+	int i, rv = 0;
+
+	for (i = 0; i < npaths; i++) {
+		if (!(ds[i] = gr260_dump_open(paths[i]))) {
+			perror(paths[i]);
+			rv = 1;
+			continue;
+		}
+		if (ds[i]->mapped && ds[i]->len) {
+			madvise((void*)ds[i]->base,ds[i]->len,MADV_SEQUENTIAL);
+		}
+		tags[i] = deviceTag(paths[i]);
+		if (!ds[i]->nwps) {
+			continue;
+		}
+		heap[n].wp = ds[i]->wps;
+		heap[n].end = ds[i]->wps+ds[i]->nwps;
+		heap[n].seq = i;
+		heap[n].src = tags[i];
+		/* without a track list it's all track 1 */
+		heap[n].track = ds[i]->ntracks ? 0 : 1;
+		heap[n].trackend = ds[i]->ntracks ? ds[i]->wps : heap[n].end;
+		heap[n].d = ds[i];
+		n++;
+	}
+	npts = merge(heap,n,UINT32_MAX,ex);
+	gr260_export_close(ex);
+	if (gVerbose) {
+		fprintf(stderr,"%zu points from %u dumps\n",npts,n);
+	}
+	for (i = 0; i < npaths; i++) {
+		gr260_dump_close(ds[i]);
+		free(tags[i]);
+	}
+	free(ds);
+	free(tags);
+	free(heap);
+	return rv;
+}
+
+/*** space ***/
+
+struct geoq {
+	const struct index* ix;
+	float lat0, lon0, lat1, lon1;
+	unsigned char* cand; /* tracks whose box overlaps */
+	unsigned* hits; /* per track */
+	const struct tipoint** pts;
+	size_t npts, cap;
+};
+
+/* marks the tracks whose bounding box overlaps the query's, returns their count */
+static unsigned geoTracks(struct geoq* const q) {
+	const struct titrack* const tr = q->ix->tracks;
+	unsigned i, n = 0;
+
+	q->cand = calloc(q->ix->h->ntracks+1,1);
+	q->hits = calloc(q->ix->h->ntracks+1,sizeof(*q->hits));
+	for (i = 0; i < q->ix->h->ntracks; i++) {
+		if (tr[i].lat0 <= q->lat1 && tr[i].lat1 >= q->lat0
+		    && tr[i].lon0 <= q->lon1 && tr[i].lon1 >= q->lon0) {
+			q->cand[i] = 1;
+			n++;
+		}
+	}
+	return n;
+}
+
+/* collects the points of candidate tracks within the box: the box is
+ * covered by aligned cells, each a contiguous run of the point index */
+static void geoPoints(struct geoq* const q) {
+	const struct tipoint* const pt = q->ix->points;
+	const uint32_t qa0 = quant(q->lat0,180), qa1 = quant(q->lat1,180);
+	const uint32_t qo0 = quant(q->lon0,360), qo1 = quant(q->lon1,360);
+	uint64_t ca, co;
+	unsigned s = 0;
+
+	while (((uint64_t)(qa1 >> s)-(qa0 >> s)+1)*((qo1 >> s)-(qo0 >> s)+1) > MAX_CELLS) {
+		s++;
+	}
+	for (ca = qa0 >> s; ca <= qa1 >> s; ca++) {
+		for (co = qo0 >> s; co <= qo1 >> s; co++) {
+			const uint64_t from = cellKey(ca << s,co << s);
+			const uint64_t to = from+((uint64_t)1 << 2*s); /* wraps for the last cell */
+			size_t a = 0, z = q->ix->h->npoints;
+
+			while (a < z) {
+				const size_t m = a+(z-a)/2;
+				if (geoKey(pt[m].lat,pt[m].lon) < from) a = m+1; else z = m;
+			}
+			for (; a < q->ix->h->npoints; a++) {
+				const struct tipoint* const p = &pt[a];
+				const uint64_t k = geoKey(p->lat,p->lon);
+
+				if (k-from >= to-from) {
+					break;
+				}
+				if (!q->cand[p->track] || p->lat < q->lat0 || p->lat > q->lat1
+				    || p->lon < q->lon0 || p->lon > q->lon1) {
+					continue;
+				}
+				q->hits[p->track]++;
+				q->pts = grow(q->pts,q->npts,sizeof(*q->pts));
+				q->pts[q->npts++] = p;
+			}
+		}
+	}
+}
+
+static void geoFree(struct geoq* const q) {
+	free(q->cand);
+	free(q->hits);
+	free(q->pts);
+}
+
+static void printPoint(const struct index* const ix, const struct tipoint* const p) {
+	const struct titrack* const t = &ix->tracks[p->track];
+
+	printf("%s track %u point %u %.7f %.7f%s",ix->strs+ix->dumps[t->dump].path,
+	       t->track+1,p->wp,p->lat,p->lon,p->is_poi ? " poi" : "");
+}
+
+/* tracks passing through the box, or its points with allpts */
+static void boxQuery(const struct index* const ix, const float box[4], const int allpts) {
+	struct geoq q = { .ix = ix, .lat0 = MIN(box[0],box[2]), .lon0 = MIN(box[1],box[3]),
+			  .lat1 = MAX(box[0],box[2]), .lon1 = MAX(box[1],box[3]) };
+	unsigned i, n = geoTracks(&q);
+
+	if (gVerbose) {
+		fprintf(stderr,"%u tracks overlap the box\n",n);
+	}
+	if (n) {
+		geoPoints(&q);
+	}
+	if (allpts) {
+		for (i = 0; i < q.npts; i++) {
+			printPoint(ix,q.pts[i]);
+			putchar('\n');
+		}
+	}
+	for (i = 0; i < ix->h->ntracks && !allpts; i++) {
+		const struct titrack* const t = &ix->tracks[i];
+		const time_t ts = (time_t)t->start+ts_offset;
+		char tbuf[32];
+
+		if (!q.hits[i]) {
+			continue;
+		}
+		strftime(tbuf,sizeof(tbuf),"%FT%TZ",gmtime(&ts));
+		printf("%s track %u %s %u points\n",ix->strs+ix->dumps[t->dump].path,
+		       t->track+1,tbuf,q.hits[i]);
+	}
+	geoFree(&q);
+}
+
+static double distance(const double lat0, const double lon0, const double lat1,
+		       const double lon1) {
+	const double r = M_PI/180;
+	const double a = pow(sin((lat1-lat0)*r/2),2)
+			 +cos(lat0*r)*cos(lat1*r)*pow(sin((lon1-lon0)*r/2),2);
+
+	return 2*EARTH_R*asin(sqrt(MIN(a,1)));
+}
+
+struct near {
+	const struct tipoint* p;
+	double d;
+};
+
+static int cmpNear(const void* a, const void* b) {
+	const double da = ((const struct near*)a)->d, db = ((const struct near*)b)->d;
+
+	return da < db ? -1 : da > db;
+}
+
+/* POIs, or all points with allpts, within m meters, nearest first */
+static void nearQuery(const struct index* const ix, const double lat, const double lon,
+		      const double m, const int allpts) {
+	const double dlat = m/EARTH_R*180/M_PI;
+	const double c = cos(lat*M_PI/180);
+	const double dlon = c*180 > dlat ? dlat/c : 180;
+	struct geoq q = { .ix = ix, .lat0 = lat-dlat, .lon0 = MAX(lon-dlon,-180),
+			  .lat1 = lat+dlat, .lon1 = MIN(lon+dlon,180) };
+	struct near* ns;
+	size_t i, n = 0;
+
+	if (geoTracks(&q)) {
+		geoPoints(&q);
+	}
+	ns = malloc((q.npts+1)*sizeof(*ns));
+	for (i = 0; i < q.npts; i++) {
+		const double d = distance(lat,lon,q.pts[i]->lat,q.pts[i]->lon);
+
+		if (d <= m && (allpts || q.pts[i]->is_poi)) {
+			ns[n].p = q.pts[i];
+			ns[n++].d = d;
+		}
+	}
+	qsort(ns,n,sizeof(*ns),cmpNear);
+	for (i = 0; i < n; i++) {
+		printPoint(ix,ns[i].p);
+		printf(" %.0fm\n",ns[i].d);
+	}
+	free(ns);
+	geoFree(&q);
+}
+
+/* unix seconds or UTC YYYY-MM-DD[THH:MM[:SS]], as device seconds */
+static int parseTime(const char s[], uint32_t* const t) {
+	struct tm tm = { 0 };
+	const char* e;
+	char* num;
+	long long v;
+
+	v = strtoll(s,&num,10);
+	if (*s && !*num) {
+		*t = v < ts_offset ? 0 : MIN(v-ts_offset,(long long)UINT32_MAX);
+		return 0;
+	}
+	e = strptime(s,"%Y-%m-%d",&tm);
+	if (e && *e == 'T') {
+		e = strptime(e+1,"%H:%M",&tm);
+		if (e && *e == ':') {
+			e = strptime(e+1,"%S",&tm);
+		}
+	}
+	if (!e || *e) {
+		return -1;
+	}
+	v = timegm(&tm);
+	*t = v < ts_offset ? 0 : MIN(v-ts_offset,(long long)UINT32_MAX);
+	return 0;
+}
+
+int main(const int argc, char* argv[]) {
+	gr260_export* const ex = gr260_export_new();
+	struct index ix;
+	uint32_t t1, t2;
+	float box[4];
+	int opt, dobuild = 0, domerge = 0, geo = 0, allpts = 0;
+
+	while ((opt = getopt(argc,argv,"Bmw:n:po:avh")) != -1) {
+		switch (opt) {
+		case 'B':
+			dobuild = 1;
+			break;
+		case 'm':
+			domerge = 1;
+			break;
+		case 'w':
+			if (sscanf(optarg,"%f,%f,%f,%f",&box[0],&box[1],&box[2],&box[3]) != 4) {
+				fprintf(stderr,"-w expects <lat>,<lon>,<lat>,<lon>\n");
+				return 1;
+			}
+			geo = 'w';
+			break;
+		case 'n':
+			if (sscanf(optarg,"%f,%f,%f",&box[0],&box[1],&box[2]) != 3) {
+				fprintf(stderr,"-n expects <lat>,<lon>,<meters>\n");
+				return 1;
+			}
+			geo = 'n';
+			break;
+		case 'p':
+			allpts = 1;
+			break;
+		case 'o':{
+			char* sep = strchr(optarg,':');
+			if (!sep) {
+				fprintf(stderr,"-o expects <format>:<file>\n");
+				return 1;
+			}
+			*sep = '\0';
+			if (gr260_export_add_sink(ex,optarg,sep+1) < 0) {
+				return 1;
+			}
+			};break;
+		case 'a':
+			gr260_export_set_altbar(ex,1);
+			break;
+		case 'v':
+			gVerbose = 1;
+			break;
+		default:
+			printf("%s -B <index> <memdump.bin|manifest>...\n"
+			       "%s [-o<format>:<file>] [-a] <index> <from> <to>\n"
+			       "%s -w<lat>,<lon>,<lat>,<lon> [-p] <index>\n"
+			       "%s -n<lat>,<lon>,<meters> [-p] <index>\n"
+			       "%s -m [-o<format>:<file>] [-a] <memdump.bin|manifest>...\n"
+			       "\t-B               build the index of the given dumps\n"
+			       "\t-m               merge the dumps' points in time order\n"
+			       "\t-w<box>          tracks passing through the box\n"
+			       "\t-n<lat,lon,m>    POIs within m meters, nearest first\n"
+			       "\t-p               every point for -w, all points for -n\n"
+			       "\t-o<fmt>:<file>   output, as for gr260dl; default txt:-\n"
+			       "\t-a               use barimetric altitude\n"
+			       "\t-v               verbose\n"
+			       "times are unix seconds or UTC YYYY-MM-DD[THH:MM[:SS]], merged\n"
+			       "points name their dump in txt, csv, gpx, geojson and ndjson\n",
+			       argv[0],argv[0],argv[0],argv[0],argv[0]);
+			return opt != 'h';
+		}
+	}
+	if (dobuild) {
+		if (argc-optind < 1) {
+			fprintf(stderr,"expecting <index> <memdump.bin>...\n");
+			return 1;
+		}
+		return build(argv[optind],argv+optind+1,argc-optind-1);
+	}
+	if (domerge) {
+		if (!ex->sinks) {
+			gr260_export_add_sink(ex,"txt","-");
+		}
+		return mergeDumps(argv+optind,argc-optind,ex);
+	}
+	if (geo) {
+		if (argc-optind != 1) {
+			fprintf(stderr,"expecting <index>\n");
+			return 1;
+		}
+		if (indexOpen(&ix,argv[optind]) < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+		if (geo == 'w') {
+			boxQuery(&ix,box,allpts);
+		} else {
+			nearQuery(&ix,box[0],box[1],box[2],allpts);
+		}
+		return 0;
+	}
+	if (argc-optind != 3) {
+		fprintf(stderr,"expecting <index> <from> <to>\n");
+		return 1;
+	}
+	if (indexOpen(&ix,argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (parseTime(argv[optind+1],&t1) < 0 || parseTime(argv[optind+2],&t2) < 0) {
+		fprintf(stderr,"cannot parse time\n");
+		return 1;
+	}
+	if (!ex->sinks) {
+		gr260_export_add_sink(ex,"txt","-");
+	}
+	query(&ix,t1,t2,ex);
+	return 0;
+}
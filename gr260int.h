@@ -0,0 +1,247 @@
+#ifndef GR260INT_H
+#define GR260INT_H
+/* internals shared by libgr260 and gr260dl, not part of the ABI */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <termios.h>
+#include <time.h>
+#include "gr260.h"
+
+#define COMMPRINTF(...) if (gCommDump) fprintf(gCommDump,__VA_ARGS__)
+
+/* USDT probes, provider gr260, if the Makefile found sys/sdt.h; each is
+ * a nop until a tracer attaches, e.g.
+ *	bpftrace -e 'usdt:./gr260dl:gr260:block_done { @[arg1] = count(); }' */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE(...) STAP_PROBEV(gr260,__VA_ARGS__)
+#else
+#define PROBE(...) do {} while (0)
+#endif
+#define MIN(a,b) ((a)<(b) ? (a) : (b))
+
+#define BLOCK_SIZE 2048 /* max data block sent by device */
+
+typedef gr260_trackinfo trackinfo;
+typedef gr260_waypoint waypoint;
+
+typedef struct { /* block of waypoints decoded into columns */
+	unsigned n, cap;
+	time_t* ts; /* ts_offset already applied */
+	float* lat;
+	float* lon;
+	uint16_t* altgps;
+	uint16_t* altbar;
+	uint16_t* altdem; /* from the --dem tiles, filled only with those */
+	uint16_t* speed;
+	uint16_t* heading;
+	uint16_t* hbr;
+	uint32_t* dist;
+	uint8_t* poi; /* bitmap, bit i%8 of byte i/8 */
+} wpcols;
+
+typedef struct { /* gmtime() of increasing timestamps, mostly the same day */
+	time_t day; /* start of tm's day */
+	int valid;
+	struct tm tm;
+} tmcache;
+
+typedef enum {
+	CMD_UNKNOWN = -3,
+	CMD_QUIT = -2,
+	CMD_NONE = -1,
+	CMD_MODEL = 0,
+	CMD_FWARE,
+	CMD_START, //2
+	CMD_TRACKCNT,
+	CMD_TRACKS, //4 - better name
+	CMD_1STSIZE,
+	CMD_OFFSIZE, //6
+	CMD_BLOCK,
+	CMD_END = 8,
+	CMD_REQTDATA,
+	CMD_RETRY
+} cmd_t;
+
+struct tlist {
+	trackinfo ti;
+	unsigned num;
+	struct tlist* prev;
+};
+
+struct plist {
+	waypoint poi;
+	struct plist* prev;
+};
+
+struct sink { /* output format, one per -g/-o */
+	const char* fmt;
+	FILE* f;
+	char* path; /* for formats writing a file per track */
+	int multifile; /* path isn't opened as f, the sink does that */
+	int flushblock; /* flush after every decoded block */
+	int parallel; /* tracks can be formatted apart, see exportParallel() */
+	int pois; /* footer writes the POIs */
+	int usealtbar;
+	int usedem; /* altdem instead, for all sinks of an export */
+	unsigned tracknum;
+	unsigned npts; /* points written to current track */
+	unsigned nfeat; /* geojson features written */
+	uint32_t dist0; /* dist of first point in track */
+	const uint16_t* alt; /* altgps, altbar or altdem of the block */
+	const trackinfo* ti; /* current track, may be NULL */
+	const char* source; /* device of the point in merged streams, else NULL */
+	unsigned rowgroup; /* arrow/parquet rows per group, 0 default */
+	char model[16]; /* device, for the arrow/parquet device table */
+	unsigned fwver;
+	void* priv;
+	void (*trackInfo)(struct sink* s, const struct tlist* tl);
+	void (*header)(struct sink* s);
+	void (*trackStart)(struct sink* s);
+	void (*point)(struct sink* s, const wpcols* c, const unsigned i,
+		      const waypoint* wp, const struct tm* ptm);
+	void (*trackEnd)(struct sink* s);
+	void (*footer)(struct sink* s, const struct plist* poilist);
+	FILE* (*append)(struct sink* s, const char path[]); /* for append:<path> */
+	struct sink* next;
+};
+
+struct gr260_export {
+	struct sink* sinks;
+	struct tlist* tracklist;
+	struct plist* poilist;
+	int started; /* headers written */
+	int usealtbar;
+	int pois; /* collect POIs, some sink writes them */
+	unsigned wpnum, tracknum;
+	unsigned nextcheck; /* wpnum where the current track may change */
+	unsigned wpbase, trackbase; /* where a single exported track starts */
+	unsigned nthreads; /* for a complete image, 0 is one per cpu */
+	unsigned rowgroup; /* copied to every sink, as are model and fwver */
+	char model[16];
+	unsigned fwver;
+	struct dem* dem; /* NULL without --dem */
+	const char* const* src; /* per record of the block fed to dumpWaypoints(),
+				 * plain [A-Za-z0-9._-] names; NULL if untagged */
+	const unsigned* srctrack; /* with src, the record's track in its dump;
+				   * a change of either starts a track */
+	wpcols cols;
+	tmcache tmc;
+};
+
+typedef struct { /* index footer of complete -b dumps, one per track */
+	uint32_t tracknum;
+	uint32_t timestamp;
+	uint32_t first; /* waypoint index */
+	uint32_t count;
+	uint32_t crc; /* CRC-32 of the track's waypoints */
+} idxentry;
+
+#define IDX_MAGIC "GR260IX1" /* last 8 bytes, after entry count and their CRC */
+
+struct gr260_dump {
+	const char* base;
+	size_t len;
+	int mapped;
+	char* buf; /* assembled from a manifest */
+	const trackinfo* tracks;
+	size_t ntracks;
+	uint32_t tlchksum;
+	const waypoint* wps;
+	size_t nwps;
+	uint32_t chksum;
+	const idxentry* index; /* NULL for dumps without footer */
+	size_t nindex;
+};
+
+#define ts_offset ((23*365+7*366)*24*3600)/*946684800*/ /* 1 Jan 2000 00:00 */
+#define fit_epoch 631065600 /* 31 Dec 1989 00:00, FIT timestamps start here */
+
+extern const char* cmds[];
+extern const char* rets[];
+extern FILE* gCommDump;
+
+/* gr260.c */
+int send_message(const int fh, const char cmd[]);
+int send_cmd(const int fh, const cmd_t cmd, ...);
+int my_strcmp(const char s1[], const char s2[]);
+uint32_t crc32Update(uint32_t crc, const void* buf, size_t len);
+void set_speed(const int fh, struct termios* const pterm,const speed_t speed);
+void trackListPrepend(const char rbuf[], const int ridx,
+		      struct tlist** const tl);
+void freeTracks(struct tlist* tl);
+void dumpTracks(const struct tlist* from, const struct tlist* const to);
+void decodeWaypoints(const char rbuf[], const int len, wpcols* const c);
+const struct tm* tmCached(const time_t t, tmcache* const tc);
+void dumpWaypoints(struct gr260_export* const ex, const char rbuf[],
+		   const int len);
+void exportTracklist(struct gr260_export* const ex, const char rbuf[],
+		     const int len);
+void exportImage(struct gr260_export* const ex, const waypoint wps[],
+		 const unsigned nwps);
+int dumpWriteIndex(const int fd);
+
+/* store.c */
+struct blockstore;
+struct blockstore* storeOpen(const char dir[]);
+void storeHeader(struct blockstore* const bs, const int32_t size, const uint32_t chksum);
+int storeBlock(struct blockstore* const bs, const void* buf, const int len,
+	       const int64_t crc);
+int storeClose(struct blockstore* const bs, const int commit, const int verbose);
+int isManifest(const void* base, const size_t len);
+char* manifestLoad(const char path[], const char man[], const size_t mlen,
+		   size_t* const len);
+
+/* sinks.c */
+const trackinfo* trackByNum(const struct tlist* tl, const unsigned num);
+#define TRACK_NAME_UTF8 (2*sizeof(((trackinfo*)0)->name)+1)
+void trackNameUtf8(const trackinfo* ti, char name[TRACK_NAME_UTF8]);
+unsigned countPOIs(const struct plist* poilist);
+void freePOIs(struct plist* poilist);
+int sinkOpen(struct sink** sl, const char fmt[], const char path[],
+	     const int usealtbar);
+void sinksTrackStart(struct sink* sl, const unsigned tracknum,
+		     const struct tlist* tl);
+void sinksTrackEnd(struct sink* sl);
+void sinksTrackInfo(struct sink* sl, const struct tlist* tl,
+		    const struct tlist* const from);
+void sinksFlush(struct sink* sl);
+void sinksClose(struct sink* sl, const int started,
+		const struct plist* poilist);
+
+/* columnar.c */
+void columnarTrackInfo(struct sink* s, const struct tlist* tl);
+void columnarPoint(struct sink* s, const wpcols* c, const unsigned i,
+		   const waypoint* wp, const struct tm* ptm);
+void columnarFooter(struct sink* s, const struct plist* poilist);
+
+/* sqlite.c, if built with HAVE_SQLITE */
+void sqliteTrackStart(struct sink* s);
+void sqlitePoint(struct sink* s, const wpcols* c, const unsigned i,
+		 const waypoint* wp, const struct tm* ptm);
+void sqliteFooter(struct sink* s, const struct plist* poilist);
+
+/* lod.c */
+void lodTrackStart(struct sink* s);
+void lodPoint(struct sink* s, const wpcols* c, const unsigned i,
+	      const waypoint* wp, const struct tm* ptm);
+void lodTrackEnd(struct sink* s);
+void lodFooter(struct sink* s, const struct plist* poilist);
+
+/* dem.c */
+struct dem;
+struct dem* demOpen(const char dir[]);
+void demFill(struct dem* const d, wpcols* const c);
+const char* demDir(const struct dem* const d);
+void demClose(struct dem* d);
+
+/* watch.c, gr260dl -w */
+struct outspec { /* an -o as given */
+	const char* fmt;
+	const char* path; /* %s is the name of the dump in watch mode */
+};
+int watchDirs(char* const dirs[], const unsigned ndirs, const struct outspec outs[],
+	      const unsigned nouts, const struct gr260_export* tmpl, unsigned nworkers);
+
+#endif
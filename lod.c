@@ -0,0 +1,194 @@
+/* level of detail pyramid of every track for map viewers, -o lod:<file>.
+ * Level 0 has all points with a position; each further one what
+ * Douglas-Peucker keeps at a tolerance of one 256px tile pixel at its
+ * zoom (lodZooms), in metres at the track's latitude.  A single pass
+ * gives every point its significance, the distance at which it would
+ * go, capped by that of the points it was split off from; a level is
+ * then the points above its tolerance, so levels nest and cost nothing
+ * more.  Little endian, like the dumps:
+ *	"GR260LOD", uint32 tracks, uint32 levels, uint32 zoom[levels]
+ *	per track and level: uint32 tracknum, uint32 count, uint64 offset
+ *	points at the offsets, from the start of the file */
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gr260int.h"
+
+#define LOD_MAGIC "GR260LOD"
+
+static const uint32_t lodZooms[] = { 0, 16, 14, 12, 10, 8 }; /* 0 is all */
+#define LOD_LEVELS (sizeof(lodZooms)/sizeof(lodZooms[0]))
+
+struct lodpoint { /* as written */
+	float lat, lon;
+	uint32_t time;
+	uint16_t alt; /* per -a/--dem, as the other outputs */
+	uint16_t poi;
+};
+
+struct lodentry {
+	uint32_t tracknum;
+	uint32_t count;
+	uint64_t offset; /* into data until the footer */
+};
+
+struct lodpriv {
+	struct lodpoint* pts; /* current track */
+	unsigned npts, cap;
+	struct lodentry* ents; /* LOD_LEVELS per track */
+	unsigned ntracks;
+	FILE* data; /* the levels of finished tracks */
+	char* buf;
+	size_t len;
+};
+
+static struct lodpriv* lodPriv(struct sink* const s) {
+	struct lodpriv* lp = s->priv;
+
+	if (!lp) {
+		lp = s->priv = calloc(1,sizeof(struct lodpriv));
+		lp->data = open_memstream(&lp->buf,&lp->len);
+	}
+	return lp;
+}
+
+void lodTrackStart(struct sink* s) {
+	lodPriv(s)->npts = 0;
+}
+
+void lodPoint(struct sink* s, const wpcols* c, const unsigned i,
+	      const waypoint __attribute__((unused)) *wp,
+	      const struct tm __attribute__((unused)) *ptm) {
+	struct lodpriv* const lp = s->priv;
+	struct lodpoint* p;
+
+	if (!isfinite(c->lat[i]) || !isfinite(c->lon[i])) {
+		return;
+	}
+	if (lp->npts == lp->cap) {
+		lp->cap = lp->cap ? 2*lp->cap : 4096;
+		lp->pts = realloc(lp->pts,lp->cap*sizeof(struct lodpoint));
+	}
+	p = &lp->pts[lp->npts++];
+	p->lat = c->lat[i];
+	p->lon = c->lon[i];
+	p->time = c->ts[i];
+	p->alt = s->alt[i];
+	p->poi = c->poi[i/8] >> (i%8) & 1;
+}
+
+/* distance of p from the segment a-b, in the plane of x/y metres */
+static double segDist(const double x[], const double y[], const unsigned a,
+		      const unsigned b, const unsigned p) {
+	const double dx = x[b]-x[a], dy = y[b]-y[a];
+	const double l2 = dx*dx+dy*dy;
+	double t = l2 > 0 ? ((x[p]-x[a])*dx+(y[p]-y[a])*dy)/l2 : 0;
+
+	t = t < 0 ? 0 : t > 1 ? 1 : t;
+	return hypot(x[a]+t*dx-x[p],y[a]+t*dy-y[p]);
+}
+
+/* Douglas-Peucker significance of every point, see the top */
+static void lodSignificance(const struct lodpoint* const pts, const unsigned n,
+			    double sig[]) {
+	struct span { unsigned a, b; double sig; } *stack;
+	const double m = 6371000*M_PI/180;
+	const double kx = m*cos(pts[0].lat*M_PI/180);
+	double *x, *y;
+	unsigned i, top = 0;
+
+	x = malloc(n*sizeof(double));
+	y = malloc(n*sizeof(double));
+	stack = malloc(n*sizeof(struct span));
+	for (i = 0; i < n; i++) {
+		x[i] = (pts[i].lon-pts[0].lon)*kx;
+		y[i] = (pts[i].lat-pts[0].lat)*m;
+		sig[i] = 0;
+	}
+	sig[0] = sig[n-1] = INFINITY;
+	stack[top++] = (struct span){ 0, n-1, INFINITY };
+	while (top) {
+		const struct span sp = stack[--top];
+		double dmax = -1;
+		unsigned k = 0;
+
+		for (i = sp.a+1; i < sp.b; i++) {
+			const double d = segDist(x,y,sp.a,sp.b,i);
+
+			if (d > dmax) {
+				dmax = d;
+				k = i;
+			}
+		}
+		if (dmax < 0) {
+			continue;
+		}
+		sig[k] = MIN(dmax,sp.sig);
+		stack[top++] = (struct span){ sp.a, k, sig[k] };
+		stack[top++] = (struct span){ k, sp.b, sig[k] };
+	}
+	free(stack);
+	free(x);
+	free(y);
+}
+
+void lodTrackEnd(struct sink* s) {
+	struct lodpriv* const lp = lodPriv(s);
+	struct lodentry* e;
+	double* sig;
+	double tpx; /* metres of a zoom 0 pixel here */
+	unsigned l, i;
+
+	if (!lp->npts) {
+		return;
+	}
+	sig = malloc(lp->npts*sizeof(double));
+	lodSignificance(lp->pts,lp->npts,sig);
+	tpx = 2*M_PI*6378137/256*cos(lp->pts[0].lat*M_PI/180);
+	lp->ents = realloc(lp->ents,(lp->ntracks+1)*LOD_LEVELS*sizeof(struct lodentry));
+	e = &lp->ents[lp->ntracks++*LOD_LEVELS];
+	for (l = 0; l < LOD_LEVELS; l++, e++) {
+		const double tol = lodZooms[l] ? tpx/(1u << lodZooms[l]) : -1;
+
+		e->tracknum = s->tracknum;
+		e->count = 0;
+		e->offset = ftello(lp->data);
+		for (i = 0; i < lp->npts; i++) {
+			if (sig[i] > tol) {
+				fwrite(&lp->pts[i],sizeof(struct lodpoint),1,lp->data);
+				e->count++;
+			}
+		}
+	}
+	free(sig);
+	lp->npts = 0;
+}
+
+void lodFooter(struct sink* s, const struct plist __attribute__((unused)) *poilist) {
+	struct lodpriv* const lp = lodPriv(s);
+	const uint32_t head[2] = { lp->ntracks, LOD_LEVELS };
+	const uint64_t base = 8+sizeof(head)+sizeof(lodZooms)
+		+(uint64_t)lp->ntracks*LOD_LEVELS*sizeof(struct lodentry);
+	unsigned i;
+
+	fclose(lp->data);
+	for (i = 0; i < lp->ntracks*LOD_LEVELS; i++) {
+		lp->ents[i].offset += base;
+	}
+	fwrite(LOD_MAGIC,8,1,s->f);
+	fwrite(head,sizeof(head),1,s->f);
+	fwrite(lodZooms,sizeof(lodZooms),1,s->f);
+	if (lp->ntracks) {
+		fwrite(lp->ents,sizeof(struct lodentry),lp->ntracks*LOD_LEVELS,s->f);
+	}
+	if (lp->len) {
+		fwrite(lp->buf,1,lp->len,s->f);
+	}
+	free(lp->buf);
+	free(lp->ents);
+	free(lp->pts);
+	free(lp);
+	s->priv = NULL;
+}
@@ -1,4 +1,4 @@
-/* taken from 3.1-rc3, LINUX_VERSION_CODE checks added */
+/* taken from 3.1-rc3, LINUX_VERSION_CODE checks and tracepoints added */
 /*
  * Prolific PL2303 USB to serial adaptor driver
  *
@@ -33,6 +33,9 @@
 #include <linux/version.h>
 #include "pl2303.h"
 
+#define CREATE_TRACE_POINTS
+#include "pl2303_trace.h"
+
 /*
  * Version Information
  */
@@ -799,6 +802,8 @@ static void pl2303_process_read_urb(struct urb *urb)
 	u8 line_status;
 	int i;
 
+	trace_pl2303_read_urb(port->number, urb->actual_length);
+
 	/* update line status */
 	spin_lock_irqsave(&priv->lock, flags);
 	line_status = priv->line_status;
@@ -841,6 +846,7 @@ static void pl2303_process_read_urb(struct urb *urb)
 	}
 
 	tty_flip_buffer_push(tty);
+	trace_pl2303_flip_push(port->number, urb->actual_length);
 	tty_kref_put(tty);
 }
 
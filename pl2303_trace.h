@@ -0,0 +1,47 @@
+/* tracepoints of the bundled pl2303 module, for measuring the time
+ * from URB completion to the push to the tty buffer work:
+ *	echo 1 > /sys/kernel/debug/tracing/events/pl2303/enable */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pl2303
+
+#if !defined(_PL2303_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PL2303_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(pl2303_read_urb,
+	TP_PROTO(int port, int len),
+	TP_ARGS(port, len),
+	TP_STRUCT__entry(
+		__field(int, port)
+		__field(int, len)
+	),
+	TP_fast_assign(
+		__entry->port = port;
+		__entry->len = len;
+	),
+	TP_printk("port=%d len=%d", __entry->port, __entry->len)
+);
+
+TRACE_EVENT(pl2303_flip_push,
+	TP_PROTO(int port, int len),
+	TP_ARGS(port, len),
+	TP_STRUCT__entry(
+		__field(int, port)
+		__field(int, len)
+	),
+	TP_fast_assign(
+		__entry->port = port;
+		__entry->len = len;
+	),
+	TP_printk("port=%d len=%d", __entry->port, __entry->len)
+);
+
+#endif /* _PL2303_TRACE_H */
+
+/* the module is built out of tree, see CFLAGS_pl2303.o */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pl2303_trace
+#include <trace/define_trace.h>
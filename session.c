@@ -0,0 +1,351 @@
+/* talking to the device: handshake, then the track list or waypoints
+ * announced with $PHLX901 and sent as $PHLX902 headered binary blocks,
+ * each asked for with $PHLX900,902,3.  No answer to that after a block
+ * ends the transfer.  A short block is asked for again, as is one that
+ * doesn't match the CRC-32 in its header.  That algorithm is a guess: a
+ * block sent the same twice is taken anyway, and if that happens before
+ * any block matched, the checksums aren't checked for the rest of the
+ * session. */
+#include <sys/select.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+#define SESS_TRIES 5 /* per command or block */
+#define SESS_REPLY 2000 /* ms */
+#define SESS_NEXT 50 /* ms, for the next block header */
+
+struct gr260_session {
+	int fd;
+	struct termios oterm, nterm;
+	int hispeed;
+	int lost; /* unplugged, the fd is left alone */
+	char model[16];
+	unsigned fwver;
+	unsigned trackcnt;
+	int first; /* next block is the transfer's first */
+	int done;
+	int n; /* received, not taken yet */
+	char buf[BLOCK_SIZE+512];
+	int crc32; /* block checksums are CRC-32: 1, 0 not, -1 not known yet */
+	int prevlen; /* a block that didn't match its checksum */
+	char prev[BLOCK_SIZE];
+};
+
+/* 1 if readable, 0 on timeout, -1 with errno (EINTR on a signal) */
+static int sessWait(const gr260_session* const s, const int ms) {
+	struct timeval tv = { ms/1000, ms%1000*1000 };
+	fd_set fds;
+
+	FD_ZERO(&fds);
+	FD_SET(s->fd,&fds);
+	return select(s->fd+1,&fds,NULL,NULL,&tv);
+}
+
+/* read() that marks the session lost on EOF or error */
+static int sessRead(gr260_session* const s, char buf[], const int len) {
+	const int n = read(s->fd,buf,len);
+
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return 0;
+	}
+	if (n <= 0) {
+		s->lost = 1;
+		if (!n)
+			errno = ENODEV;
+		return -1;
+	}
+	return n;
+}
+
+/* next line starting with $, without \r\n; 1, 0 on timeout or -1 */
+static int sessLine(gr260_session* const s, char line[], const size_t len,
+		    const int ms) {
+	for (;;) {
+		char* const nl = memchr(s->buf,'\n',s->n);
+		int rv;
+
+		if (nl) {
+			const int used = nl-s->buf+1;
+			const char* p = nl;
+			const char* end = nl;
+			int found;
+
+			while (p > s->buf && p[-1] != '$')
+				p--;
+			found = p > s->buf;
+			if (found) {
+				if (end > p && end[-1] == '\r')
+					end--;
+				snprintf(line,len,"$%.*s",(int)(end-p),p);
+			}
+			s->n -= used;
+			memmove(s->buf,s->buf+used,s->n);
+			if (found) {
+				COMMPRINTF("%s\\r\n",line);
+				PROBE(line,line,strlen(line));
+				return 1;
+			}
+			continue;
+		}
+		if (s->n == sizeof(s->buf)) {
+			s->n = 0; /* garbage */
+		}
+		rv = sessWait(s,ms);
+		if (rv <= 0) {
+			return rv;
+		}
+		if ((rv = sessRead(s,s->buf+s->n,sizeof(s->buf)-s->n)) < 0) {
+			return -1;
+		}
+		s->n += rv;
+	}
+}
+
+/* sends cmd until a line starting with prefix comes back */
+static int sessAsk(gr260_session* const s, const char cmd[], const char prefix[],
+		   char line[], const size_t len) {
+	int i, rv;
+
+	for (i = 0; i < SESS_TRIES; i++) {
+		send_message(s->fd,cmd);
+		while ((rv = sessLine(s,line,len,SESS_REPLY)) > 0) {
+			if (!my_strcmp(line,prefix))
+				return 0;
+		}
+		if (rv < 0) {
+			return -1;
+		}
+	}
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+/* up to len bytes of block data, fewer if they stop coming */
+static int sessData(gr260_session* const s, char buf[], const int len, const int ms) {
+	int n = MIN(s->n,len), rv;
+
+	memcpy(buf,s->buf,n);
+	s->n -= n;
+	memmove(s->buf,s->buf+n,s->n);
+	while (n < len) {
+		rv = sessWait(s,ms);
+		if (rv < 0) {
+			return -1;
+		}
+		if (!rv) {
+			break;
+		}
+		if ((rv = sessRead(s,buf+n,len-n)) < 0) {
+			return -1;
+		}
+		n += rv;
+	}
+	return n;
+}
+
+/* $PHLX827, and the port as it was */
+static void sessEnd(gr260_session* const s) {
+	if (s->lost) {
+		return;
+	}
+	if (!s->hispeed) {
+		set_speed(s->fd,&s->nterm,B921600);
+	}
+	send_cmd(s->fd,CMD_END);
+	tcsetattr(s->fd,TCSANOW,&s->oterm);
+}
+
+gr260_session* gr260_session_open(int fd) {
+	gr260_session* const s = calloc(1,sizeof(gr260_session));
+	char line[64];
+	int err;
+
+	if (!s) {
+		return NULL;
+	}
+	s->fd = fd;
+	s->crc32 = -1;
+	if (tcgetattr(fd,&s->oterm) < 0) {
+		free(s);
+		return NULL;
+	}
+	s->nterm = s->oterm;
+	cfmakeraw(&s->nterm);
+	set_speed(fd,&s->nterm,B38400);
+	if (sessAsk(s,cmds[CMD_MODEL],"$PHLX852,",line,sizeof(line)) < 0) {
+		goto fail;
+	}
+	sscanf(line,"$PHLX852,%15[^*]",s->model);
+	if (sessAsk(s,cmds[CMD_FWARE],rets[CMD_FWARE],line,sizeof(line)) < 0) {
+		goto fail;
+	}
+	s->fwver = atoi(line+strlen(rets[CMD_FWARE]));
+	if (sessAsk(s,cmds[CMD_START],"$PHLX859",line,sizeof(line)) < 0) {
+		goto fail;
+	}
+	set_speed(fd,&s->nterm,B921600);
+	s->hispeed = 1;
+	if (sessAsk(s,cmds[CMD_TRACKCNT],rets[CMD_TRACKCNT],line,sizeof(line)) < 0) {
+		goto fail;
+	}
+	sscanf(line+strlen(rets[CMD_TRACKCNT]),"%u",&s->trackcnt);
+	return s;
+fail:
+	err = errno;
+	sessEnd(s);
+	free(s);
+	errno = err;
+	return NULL;
+}
+
+const char* gr260_session_model(const gr260_session* s) {
+	return s->model;
+}
+
+unsigned gr260_session_firmware(const gr260_session* s) {
+	return s->fwver;
+}
+
+unsigned gr260_session_track_count(const gr260_session* s) {
+	return s->trackcnt;
+}
+
+/* cmd is answered by $PHLX900,<cmd>,3 and $PHLX901,<size>,<checksum> */
+static int sessTransfer(gr260_session* const s, const char cmd[],
+			uint32_t* const size, uint32_t* const chksum) {
+	char line[64];
+	int32_t n;
+
+	if (sessAsk(s,cmd,rets[5],line,sizeof(line)) < 0) {
+		return -1;
+	}
+	if (sscanf(line+strlen(rets[5]),"%d,%X",&n,chksum) != 2 || n < 0) {
+		errno = EPROTO;
+		return -1;
+	}
+	*size = n;
+	s->first = 1;
+	s->done = 0;
+	if (!n) { /* acked, but there is no block to wait for */
+		send_cmd(s->fd,CMD_1STSIZE);
+		s->done = 1;
+	}
+	return 0;
+}
+
+int gr260_session_tracklist(gr260_session* s, uint32_t* size, uint32_t* chksum) {
+	char cmd[32];
+
+	snprintf(cmd,sizeof(cmd),"%s%u",cmds[CMD_TRACKS],s->trackcnt);
+	return sessTransfer(s,cmd,size,chksum);
+}
+
+int gr260_session_waypoints(gr260_session* s, uint32_t from, uint32_t to,
+			    uint32_t* size, uint32_t* chksum) {
+	char cmd[32];
+
+	snprintf(cmd,sizeof(cmd),"%s%u,%u",cmds[CMD_REQTDATA],from,to);
+	return sessTransfer(s,cmd,size,chksum);
+}
+
+int gr260_session_next_block(gr260_session* s, void* buf, uint32_t* crc) {
+	cmd_t cmd = s->first ? CMD_1STSIZE : CMD_OFFSIZE;
+	char line[64];
+	int tries = 0;
+
+	if (s->done) {
+		return 0;
+	}
+	s->prevlen = 0;
+	for (;;) {
+		int offset, len, n, rv;
+		unsigned c;
+
+		send_cmd(s->fd,cmd);
+		while ((rv = sessLine(s,line,sizeof(line),cmd == CMD_OFFSIZE ? SESS_NEXT
+							    : SESS_REPLY)) > 0
+		       && my_strcmp(line,rets[6]))
+			;
+		if (rv < 0) {
+			return -1;
+		}
+		if (!rv) {
+			if (cmd == CMD_OFFSIZE) { /* nothing after the last block */
+				s->done = 1;
+				return 0;
+			}
+			if (++tries == SESS_TRIES) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			continue;
+		}
+		s->first = 0;
+		if (sscanf(line+strlen(rets[6]),"%d,%d,%X",&offset,&len,&c) != 3
+		    || len <= 0 || len > BLOCK_SIZE) {
+			errno = EPROTO;
+			return -1;
+		}
+		PROBE(block_start,offset,len);
+		send_cmd(s->fd,CMD_BLOCK);
+		if ((n = sessData(s,buf,len,SESS_REPLY)) < 0) {
+			return -1;
+		}
+		COMMPRINTF("\n");
+		if (n == len) {
+			const uint32_t got = crc32Update(0,buf,n);
+			const int again = n == s->prevlen && !memcmp(buf,s->prev,n);
+
+			/* the first full block decides for the session */
+			if (got == c) {
+				s->crc32 = 1;
+			} else if (again && s->crc32 < 0) {
+				s->crc32 = 0;
+			}
+			if (got == c || again || !s->crc32) {
+				if (crc)
+					*crc = c;
+				return n;
+			}
+			/* taken if it comes the same again */
+			COMMPRINTF("CRC! %08X!=%08X\n",got,c);
+			memcpy(s->prev,buf,n);
+			s->prevlen = n;
+		} else {
+			COMMPRINTF("FAILED! %d!=%d\n",n,len);
+		}
+		PROBE(retry,n,len);
+		if (++tries == SESS_TRIES) {
+			errno = EIO;
+			return -1;
+		}
+		cmd = CMD_RETRY; /* the header comes again */
+	}
+}
+
+int gr260_session_command(gr260_session* s, const char cmd[], char reply[],
+			  size_t len) {
+	int i, rv;
+
+	send_message(s->fd,cmd);
+	for (i = 0; i < 5; i++) { /* 10s */
+		if ((rv = sessLine(s,reply,len,SESS_REPLY)) != 0) {
+			return rv > 0 ? 0 : -1;
+		}
+	}
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+void gr260_session_close(gr260_session* s) {
+	if (s) {
+		sessEnd(s);
+		free(s);
+	}
+}
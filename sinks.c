@@ -0,0 +1,1183 @@
+/* output sinks, every format is a set of callbacks in sinkfmts[] */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+static void dumpGpxHeader(FILE* f) {
+	fprintf(f,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<gpx\n"
+		"  version=\"1.0\"\n"
+		"  creator=\"GPSBabel - http://www.gpsbabel.org\"\n"
+		"  xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
+		"  xmlns=\"http://www.topografix.com/GPX/1/0\"\n"
+		"  xmlns:gpxtpx=\"http://www.garmin.com/xmlschemas/TrackPointExtension/v1\"\n"
+		"  xsi:schemaLocation=\"http://www.topografix.com/GPX/1/0 "
+			"http://www.topografix.com/GPX/1/0/gpx.xsd\">\n");
+}
+
+static void dumpTrackHeader(FILE* f,unsigned tracknum) {
+	fprintf(f,"<trk>\n"
+		"  <name>track-%d</name>\n"
+		"<trkseg>\n",tracknum);
+	//<time>2011-06-28T20:27:31Z</time>
+	//<bounds minlat=\"52.094039377\" minlon=\"20.592039437\" maxlat=\"52.310363814\" maxlon=\"21.030777570\"/>
+	//  <desc>Log every 2 sec, 0 m</desc>
+	// 
+}
+
+static void dumpTrackEnd(FILE* f) {
+	fprintf(f,"</trkseg>\n</trk>\n");
+}
+
+unsigned countPOIs(const struct plist* poilist) {
+	unsigned n = 0;
+
+	for (; poilist; poilist = poilist->prev)
+		n++;
+	return n;
+}
+
+void freePOIs(struct plist* poilist) {
+	while (poilist) {
+		struct plist* tmp = poilist->prev;
+		free(poilist);
+		poilist = tmp;
+	}
+}
+
+/* the POIs newer than after, numbered from base+1 */
+static void dumpPOIs(FILE* f,const struct plist* poilist,const time_t after,
+		     const unsigned base) {
+	const struct plist* p;
+	char tbuf[64];
+	unsigned wpnum = base;
+
+	for (p = poilist; p; p = p->prev) {
+		if (p->poi.timestamp + ts_offset > after)
+			wpnum++;
+	}
+	for (; poilist; poilist = poilist->prev) {
+		const waypoint* poi = &(poilist->poi);
+		time_t t = poi->timestamp + ts_offset;
+		struct tm tm;
+
+		if (t <= after)
+			continue;
+		strftime(tbuf,sizeof(tbuf),"%FT%TZ",gmtime_r(&t,&tm));
+		fprintf(f,"<wpt lat=\"%.7f\" lon=\"%.7f\">\n"
+			"  <ele>%d</ele>\n"
+			"  <time>%s</time>\n"
+			"  <name>WP%06d</name>\n"
+			"</wpt>\n",
+			poi->lat,poi->lon,poi->altgps,tbuf,wpnum);
+		wpnum--;
+	}
+}
+
+/* printf-free formatting of the per-point fields, giving the same text as
+ * the conversion noted for each; points are the bulk of every export */
+#define PUTS(p,lit) (memcpy(p,lit,sizeof(lit)-1),(p) += sizeof(lit)-1)
+
+static char* putUintW(char* p, unsigned v, unsigned width) { /* %*u */
+	char tmp[10];
+	unsigned n = 0;
+
+	do {
+		tmp[n++] = '0'+v%10;
+		v /= 10;
+	} while (v);
+	for (; width > n; width--)
+		*p++ = ' ';
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static char* putUint(char* p, const unsigned v) { /* %u */
+	return putUintW(p,v,0);
+}
+
+/* %*.*f, prec <= 7: v*10^prec of a float is exact in a double */
+static char* putFixed(char* p, const float v, const unsigned prec,
+		      const unsigned width) {
+	static const double scale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7 };
+	const double ax = fabs(v)*scale[prec];
+	char tmp[32], *t = tmp+sizeof(tmp);
+	uint64_t q;
+	double frac;
+	unsigned n;
+
+	if (!isfinite(v) || ax >= 1e18) {
+		return p+sprintf(p,"%*.*f",(int)width,(int)prec,v);
+	}
+	q = ax;
+	frac = ax-q;
+	if (frac > .5 || (frac == .5 && (q & 1))) /* to even, as printf */
+		q++;
+	for (n = 0; n < prec; n++, q /= 10)
+		*--t = '0'+q%10;
+	if (prec)
+		*--t = '.';
+	do {
+		*--t = '0'+q%10;
+		q /= 10;
+	} while (q);
+	if (signbit(v))
+		*--t = '-';
+	for (n = tmp+sizeof(tmp)-t; n < width; n++)
+		*p++ = ' ';
+	memcpy(p,t,tmp+sizeof(tmp)-t);
+	return p+(tmp+sizeof(tmp)-t);
+}
+
+/* %.6f of speed/36., which never falls on a tie */
+static char* putSpeed(char* p, const unsigned speed) {
+	const uint64_t n = (uint64_t)speed*250000; /* speed/36*10^6 = n/9 */
+	const uint64_t q = n/9+(n%9 >= 5);
+	unsigned i;
+
+	p = putUint(p,q/1000000);
+	*p++ = '.';
+	for (i = 100000; i; i /= 10)
+		*p++ = '0'+q/i%10;
+	return p;
+}
+
+/* %Y-%m-%d<sep>%H:%M:%S */
+static char* putTime(char* p, const struct tm* const ptm, const char sep) {
+	const int year = ptm->tm_year+1900;
+
+	if (year < 1000 || year > 9999) {
+		p += strftime(p,32,"%Y-%m-%d",ptm);
+		*p++ = sep;
+		return p+strftime(p,16,"%H:%M:%S",ptm);
+	}
+	p = putUint(p,year);
+	*p++ = '-';
+	*p++ = '0'+(ptm->tm_mon+1)/10;
+	*p++ = '0'+(ptm->tm_mon+1)%10;
+	*p++ = '-';
+	*p++ = '0'+ptm->tm_mday/10;
+	*p++ = '0'+ptm->tm_mday%10;
+	*p++ = sep;
+	*p++ = '0'+ptm->tm_hour/10;
+	*p++ = '0'+ptm->tm_hour%10;
+	*p++ = ':';
+	*p++ = '0'+ptm->tm_min/10;
+	*p++ = '0'+ptm->tm_min%10;
+	*p++ = ':';
+	*p++ = '0'+ptm->tm_sec/10;
+	*p++ = '0'+ptm->tm_sec%10;
+	return p;
+}
+
+static void gpxHeader(struct sink* s) {
+	dumpGpxHeader(s->f);
+}
+
+static void gpxTrackStart(struct sink* s) {
+	dumpTrackHeader(s->f,s->tracknum);
+}
+
+static void gpxPoint(struct sink* s, const wpcols* c, const unsigned i,
+		     const waypoint __attribute__((unused)) *wp,
+		     const struct tm* ptm) {
+	char buf[512], *p = buf;
+
+	PUTS(p,"<trkpt lat=\"");
+	p = putFixed(p,c->lat[i],7,0);
+	PUTS(p,"\" lon=\"");
+	p = putFixed(p,c->lon[i],7,0);
+	PUTS(p,"\">\n  <ele>");
+	p = putUint(p,s->alt[i]);
+	PUTS(p,"</ele>\n  <time>");
+	p = putTime(p,ptm,'T');
+	PUTS(p,"Z</time>\n  <course>");
+	p = putUint(p,c->heading[i]);
+	PUTS(p,"</course>\n  <speed>");
+	p = putSpeed(p,c->speed[i]);
+	PUTS(p,"</speed>\n");
+	if (s->source) { /* <src> comes before <extensions> */
+		fwrite(buf,1,p-buf,s->f);
+		p = buf;
+		fprintf(s->f,"  <src>%s</src>\n",s->source);
+	}
+	if (c->hbr[i]) {
+		PUTS(p,"  <extensions>\n"
+		     "    <gpxtpx:TrackPointExtension>\n"
+		     "    <gpxtpx:hr>");
+		p = putUint(p,c->hbr[i]);
+		PUTS(p,"</gpxtpx:hr>\n"
+		     "    </gpxtpx:TrackPointExtension>\n"
+		     "  </extensions>\n");
+	}
+	PUTS(p,"</trkpt>\n");
+	fwrite(buf,1,p-buf,s->f);
+}
+
+static void gpxTrackEnd(struct sink* s) {
+	dumpTrackEnd(s->f);
+}
+
+static void gpxFooter(struct sink* s, const struct plist* poilist) {
+	dumpPOIs(s->f,poilist,0,0);
+	fprintf(s->f,"</gpx>\n");
+}
+
+/* fopen() with the outputs' buffer; setvbuf() has to come before
+ * anything else is done with the stream */
+static FILE* sinkFopen(const char path[], const char mode[]) {
+	FILE* const f = fopen(path,mode);
+
+	if (f)
+		setvbuf(f,NULL,_IOFBF,1<<16);
+	return f;
+}
+
+/* -o gpx:append:<file> adds the points newer than the file's last one.
+ * Only its end is read, back to the last </trk>; the POIs after it are
+ * kept in memory, written again after the new tracks, and the file is cut
+ * behind </gpx> then.  Nothing is touched if no point is exported. */
+#define GPX_CHUNK 65536
+
+struct gpxappend {
+	char* tail; /* the old POIs */
+	size_t taillen;
+	unsigned npois;
+	time_t last; /* newest point in the file */
+	int intrack;
+	int written; /* a newer point, else the file is left alone */
+};
+
+/* offset of the last lit in buf[0..len), -1 if none */
+static long memrstr(const char* buf, size_t len, const char lit[]) {
+	const size_t n = strlen(lit);
+
+	for (; len >= n; len--) {
+		if (!memcmp(buf+len-n,lit,n))
+			return len-n;
+	}
+	return -1;
+}
+
+static void gpxAppendTrackStart(struct sink* s) {
+	struct gpxappend* ga = s->priv;
+
+	ga->intrack = 0;
+}
+
+static void gpxAppendPoint(struct sink* s, const wpcols* c, const unsigned i,
+			   const waypoint* wp, const struct tm* ptm) {
+	struct gpxappend* ga = s->priv;
+
+	if (c->ts[i] <= ga->last)
+		return;
+	if (!ga->intrack) {
+		dumpTrackHeader(s->f,s->tracknum);
+		ga->intrack = 1;
+		ga->written = 1;
+	}
+	gpxPoint(s,c,i,wp,ptm);
+}
+
+static void gpxAppendTrackEnd(struct sink* s) {
+	struct gpxappend* ga = s->priv;
+
+	if (ga->intrack)
+		dumpTrackEnd(s->f);
+	ga->intrack = 0;
+}
+
+static void gpxAppendFooter(struct sink* s, const struct plist* poilist) {
+	struct gpxappend* ga = s->priv;
+
+	if (ga->written) {
+		fwrite(ga->tail,1,ga->taillen,s->f);
+		dumpPOIs(s->f,poilist,ga->last,ga->npois);
+		fprintf(s->f,"</gpx>\n");
+		if (fflush(s->f) || ftruncate(fileno(s->f),ftello(s->f)))
+			perror("append");
+	}
+	free(ga->tail);
+	free(ga);
+	s->priv = NULL;
+}
+
+static FILE* gpxAppend(struct sink* s, const char path[]) {
+	FILE* f = sinkFopen(path,"r+");
+	struct gpxappend* ga;
+	char *buf = NULL, *p;
+	size_t len = 0;
+	off_t pos, end = -1;
+	long tm = -1, gpx, w;
+	struct tm t;
+
+	if (!f && errno == ENOENT)
+		f = sinkFopen(path,"w"); /* a new file is written whole */
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+	if (fseeko(f,0,SEEK_END) || (pos = ftello(f)) <= 0)
+		return f;
+	while (pos > 0 && tm < 0) { /* back to the time of the last point */
+		const size_t n = pos < GPX_CHUNK ? pos : GPX_CHUNK;
+		char* nb = malloc(n+len);
+
+		pos -= n;
+		if (!nb || pread(fileno(f),nb,n,pos) != (ssize_t)n) {
+			perror(path);
+			free(nb);
+			free(buf);
+			fclose(f);
+			return NULL;
+		}
+		if (len)
+			memcpy(nb+n,buf,len);
+		free(buf);
+		buf = nb;
+		len += n;
+		if (end < 0 && (w = memrstr(buf,len,"</trk>\n")) >= 0)
+			end = pos+w+strlen("</trk>\n");
+		if (end >= 0)
+			tm = memrstr(buf,end-pos,"<time>");
+	}
+	if (end < 0) { /* no tracks yet, the POIs follow the header */
+		end = memrstr(buf,len,"</gpx>");
+		while (end > 0 && (w = memrstr(buf,end,"<wpt ")) >= 0)
+			end = w;
+	}
+	gpx = memrstr(buf,len,"</gpx>");
+	if (end < 0 || gpx < end-pos) {
+		fprintf(stderr,"%s: no </gpx>, not appending\n",path);
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	ga = calloc(1,sizeof(struct gpxappend));
+	ga->taillen = gpx-(end-pos);
+	ga->tail = malloc(ga->taillen+1);
+	memcpy(ga->tail,buf+(end-pos),ga->taillen);
+	ga->tail[ga->taillen] = '\0';
+	for (p = ga->tail; (p = strstr(p,"<wpt ")); p++)
+		ga->npois++;
+	memset(&t,0,sizeof(t));
+	if (tm >= 0 && sscanf(buf+tm,"<time>%d-%d-%dT%d:%d:%dZ",&t.tm_year,&t.tm_mon,
+			      &t.tm_mday,&t.tm_hour,&t.tm_min,&t.tm_sec) == 6) {
+		t.tm_year -= 1900;
+		t.tm_mon--;
+		ga->last = timegm(&t);
+	}
+	free(buf);
+	fseeko(f,end,SEEK_SET);
+	s->priv = ga;
+	s->parallel = 0;
+	s->header = NULL;
+	s->trackStart = gpxAppendTrackStart;
+	s->point = gpxAppendPoint;
+	s->trackEnd = gpxAppendTrackEnd;
+	s->footer = gpxAppendFooter;
+	return f;
+}
+
+/* the old default output, one line per waypoint */
+static void txtPoint(struct sink* s, const wpcols* c, const unsigned i,
+		     const waypoint* wp, const struct tm* ptm) {
+	char buf[256], *p = buf;
+
+	/* "%2u: %s %8.6f %8.6f %3d %2d %3u %2u %1d %5d %5d %5d %5u %u" */
+	p = putUintW(p,i+1,2);
+	PUTS(p,": ");
+	p = putTime(p,ptm,'_');
+	*p++ = ' ';
+	p = putFixed(p,c->lat[i],6,8);
+	*p++ = ' ';
+	p = putFixed(p,c->lon[i],6,8);
+	*p++ = ' ';
+	p = putUintW(p,c->altgps[i],3);
+	*p++ = ' ';
+	p = putUintW(p,(c->speed[i]+5)/10,2);
+	*p++ = ' ';
+	p = putUintW(p,wp->unk1,3);
+	*p++ = ' ';
+	p = putUintW(p,wp->unk2,2);
+	*p++ = ' ';
+	p = putUint(p,wp->is_poi);
+	*p++ = ' ';
+	p = putUintW(p,c->hbr[i],5);
+	*p++ = ' ';
+	p = putUintW(p,c->altbar[i],5);
+	*p++ = ' ';
+	p = putUintW(p,c->heading[i],5);
+	*p++ = ' ';
+	p = putUintW(p,c->dist[i],5);
+	*p++ = ' ';
+	p = putUint(p,wp->unk7);
+	fwrite(buf,1,p-buf,s->f);
+	if (s->source) {
+		fprintf(s->f," %s",s->source);
+	}
+	putc('\n',s->f);
+}
+
+static void csvHeader(struct sink* s) {
+	fprintf(s->f,"track,time,lat,lon,ele,speed,course,hr,dist,poi%s\n",
+		s->source ? ",device" : "");
+}
+
+static void csvPoint(struct sink* s, const wpcols* c, const unsigned i,
+		     const waypoint __attribute__((unused)) *wp,
+		     const struct tm* ptm) {
+	char buf[256], *p = buf;
+
+	p = putUint(p,s->tracknum);
+	*p++ = ',';
+	p = putTime(p,ptm,'T');
+	PUTS(p,"Z,");
+	p = putFixed(p,c->lat[i],7,0);
+	*p++ = ',';
+	p = putFixed(p,c->lon[i],7,0);
+	*p++ = ',';
+	p = putUint(p,s->alt[i]);
+	*p++ = ',';
+	p = putSpeed(p,c->speed[i]);
+	*p++ = ',';
+	p = putUint(p,c->heading[i]);
+	*p++ = ',';
+	p = putUint(p,c->hbr[i]);
+	*p++ = ',';
+	p = putUint(p,c->dist[i]);
+	*p++ = ',';
+	*p++ = '0'+((c->poi[i/8] >> (i%8)) & 1);
+	fwrite(buf,1,p-buf,s->f);
+	if (s->source) {
+		fprintf(s->f,",%s",s->source);
+	}
+	putc('\n',s->f);
+}
+
+static void geojsonHeader(struct sink* s) {
+	fprintf(s->f,"{\"type\":\"FeatureCollection\",\"features\":[");
+}
+
+static void geojsonPoint(struct sink* s, const wpcols* c, const unsigned i,
+			 const waypoint __attribute__((unused)) *wp,
+			 const struct tm* ptm) {
+	char tbuf[64];
+
+	strftime(tbuf,sizeof(tbuf),"%FT%TZ",ptm);
+	fprintf(s->f,"%s\n{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\","
+		"\"coordinates\":[%.7f,%.7f,%d]},\"properties\":{\"track\":%u,"
+		"\"time\":\"%s\",\"speed\":%.6f,\"course\":%d,\"hr\":%d,\"dist\":%u%s%s%s}}",
+		s->nfeat++ ? "," : "",c->lon[i],c->lat[i],
+		s->alt[i],s->tracknum,tbuf,
+		c->speed[i]/36.,c->heading[i],c->hbr[i],c->dist[i],
+		s->source ? ",\"device\":\"" : "",s->source ? s->source : "",
+		s->source ? "\"" : "");
+}
+
+static void geojsonFooter(struct sink* s, const struct plist* poilist) {
+	char tbuf[64];
+	unsigned wpnum = countPOIs(poilist);
+
+	for (; poilist; poilist = poilist->prev, wpnum--) {
+		const waypoint* poi = &(poilist->poi);
+		time_t t = poi->timestamp + ts_offset;
+		struct tm tm;
+
+		strftime(tbuf,sizeof(tbuf),"%FT%TZ",gmtime_r(&t,&tm));
+		fprintf(s->f,"%s\n{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\","
+			"\"coordinates\":[%.7f,%.7f,%d]},\"properties\":"
+			"{\"name\":\"WP%06d\",\"time\":\"%s\",\"poi\":true}}",
+			s->nfeat++ ? "," : "",poi->lon,poi->lat,poi->altgps,
+			wpnum,tbuf);
+	}
+	fprintf(s->f,"\n]}\n");
+}
+
+/* gx:Track wants all <when>s, then all coords, then the hr array,
+ * so the latter two are collected per track */
+struct kmlpriv {
+	char *cbuf, *hbuf;
+	size_t clen, hlen;
+	FILE *cf, *hf;
+};
+
+static void kmlHeader(struct sink* s) {
+	fprintf(s->f,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<kml xmlns=\"http://www.opengis.net/kml/2.2\""
+		" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n"
+		"<Document>\n"
+		"<Schema id=\"gr260\">\n"
+		"  <gx:SimpleArrayField name=\"heartrate\" type=\"int\">\n"
+		"    <displayName>Heart Rate</displayName>\n"
+		"  </gx:SimpleArrayField>\n"
+		"</Schema>\n");
+	s->priv = calloc(1,sizeof(struct kmlpriv));
+}
+
+static void kmlTrackStart(struct sink* s) {
+	struct kmlpriv* kp = s->priv;
+
+	fprintf(s->f,"<Placemark>\n"
+		"  <name>track-%d</name>\n"
+		"<gx:Track>\n",s->tracknum);
+	kp->cf = open_memstream(&kp->cbuf,&kp->clen);
+	kp->hf = open_memstream(&kp->hbuf,&kp->hlen);
+}
+
+static void kmlPoint(struct sink* s, const wpcols* c, const unsigned i,
+		     const waypoint __attribute__((unused)) *wp,
+		     const struct tm* ptm) {
+	struct kmlpriv* kp = s->priv;
+	char tbuf[64];
+
+	strftime(tbuf,sizeof(tbuf),"%FT%TZ",ptm);
+	fprintf(s->f,"  <when>%s</when>\n",tbuf);
+	fprintf(kp->cf,"  <gx:coord>%.7f %.7f %d</gx:coord>\n",c->lon[i],c->lat[i],
+		s->alt[i]);
+	if (c->hbr[i]) {
+		fprintf(kp->hf,"    <gx:value>%d</gx:value>\n",c->hbr[i]);
+	} else {
+		fprintf(kp->hf,"    <gx:value/>\n");
+	}
+}
+
+static void kmlTrackEnd(struct sink* s) {
+	struct kmlpriv* kp = s->priv;
+
+	fclose(kp->cf);
+	fclose(kp->hf);
+	fwrite(kp->cbuf,1,kp->clen,s->f);
+	fprintf(s->f,"  <ExtendedData>\n"
+		"  <SchemaData schemaUrl=\"#gr260\">\n"
+		"  <gx:SimpleArrayData name=\"heartrate\">\n");
+	fwrite(kp->hbuf,1,kp->hlen,s->f);
+	fprintf(s->f,"  </gx:SimpleArrayData>\n"
+		"  </SchemaData>\n"
+		"  </ExtendedData>\n"
+		"</gx:Track>\n"
+		"</Placemark>\n");
+	free(kp->cbuf);
+	free(kp->hbuf);
+}
+
+static void kmlFooter(struct sink* s, const struct plist* poilist) {
+	unsigned wpnum = countPOIs(poilist);
+
+	for (; poilist; poilist = poilist->prev, wpnum--) {
+		const waypoint* poi = &(poilist->poi);
+		fprintf(s->f,"<Placemark>\n"
+			"  <name>WP%06d</name>\n"
+			"  <Point><coordinates>%.7f,%.7f,%d</coordinates></Point>\n"
+			"</Placemark>\n",wpnum,poi->lon,poi->lat,poi->altgps);
+	}
+	fprintf(s->f,"</Document>\n</kml>\n");
+	free(s->priv);
+}
+
+static void tcxHeader(struct sink* s) {
+	fprintf(s->f,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<TrainingCenterDatabase"
+		" xmlns=\"http://www.garmin.com/xmlschemas/TrainingCenterDatabase/v2\""
+		" xmlns:ns3=\"http://www.garmin.com/xmlschemas/ActivityExtension/v2\">\n"
+		"<Activities>\n");
+}
+
+static void tcxPoint(struct sink* s, const wpcols* c, const unsigned i,
+		     const waypoint __attribute__((unused)) *wp,
+		     const struct tm* ptm) {
+	char tbuf[64];
+
+	strftime(tbuf,sizeof(tbuf),"%FT%TZ",ptm);
+	if (!s->npts) { /* lap totals come before the points */
+		fprintf(s->f,"<Activity Sport=\"Other\">\n"
+			"  <Id>%s</Id>\n"
+			"  <Lap StartTime=\"%s\">\n"
+			"    <TotalTimeSeconds>%u</TotalTimeSeconds>\n"
+			"    <DistanceMeters>%u</DistanceMeters>\n"
+			"    <Calories>0</Calories>\n"
+			"    <Intensity>Active</Intensity>\n"
+			"    <TriggerMethod>Manual</TriggerMethod>\n"
+			"    <Track>\n",tbuf,tbuf,
+			s->ti ? s->ti->duration : 0,s->ti ? s->ti->length : 0);
+	}
+	fprintf(s->f,"    <Trackpoint>\n"
+		"      <Time>%s</Time>\n"
+		"      <Position>\n"
+		"        <LatitudeDegrees>%.7f</LatitudeDegrees>\n"
+		"        <LongitudeDegrees>%.7f</LongitudeDegrees>\n"
+		"      </Position>\n"
+		"      <AltitudeMeters>%d</AltitudeMeters>\n"
+		"      <DistanceMeters>%u</DistanceMeters>\n",
+		tbuf,c->lat[i],c->lon[i],s->alt[i],
+		c->dist[i]-s->dist0);
+	if (c->hbr[i]) {
+		fprintf(s->f,"      <HeartRateBpm><Value>%d</Value></HeartRateBpm>\n",
+			c->hbr[i]);
+	}
+	fprintf(s->f,"      <Extensions><ns3:TPX><ns3:Speed>%.6f</ns3:Speed></ns3:TPX></Extensions>\n"
+		"    </Trackpoint>\n",c->speed[i]/36.);
+}
+
+static void tcxTrackEnd(struct sink* s) {
+	if (s->npts) {
+		fprintf(s->f,"    </Track>\n  </Lap>\n</Activity>\n");
+	}
+}
+
+static void tcxFooter(struct sink* s,
+		      const struct plist __attribute__((unused)) *poilist) {
+	fprintf(s->f,"</Activities>\n</TrainingCenterDatabase>\n");
+}
+
+/* FIT activity, one file per track, written as <dir>/track-<n>.fit
+ * the file is built in memory because the header holds data size and
+ * the trailing crc covers everything */
+struct fitpriv {
+	char* buf;
+	size_t len;
+	FILE* mf;
+	uint32_t t0, t1; /* FIT time of first/last point */
+	int32_t lat0, lon0;
+	uint32_t dist1;
+	uint16_t maxspeed;
+	uint8_t maxhr;
+	uint32_t hrsum, hrcnt;
+};
+
+enum { /* local message types */
+	FIT_FILE_ID, FIT_DEV_ID, FIT_FIELD_DESC, FIT_RECORD, FIT_LAP,
+	FIT_SESSION, FIT_ACTIVITY
+};
+
+static const uint8_t fitFileIdDef[][3] = { /* field, size, base type */
+	{ 0, 1, 0x00 }, /* type */
+	{ 1, 2, 0x84 }, /* manufacturer */
+	{ 2, 2, 0x84 }, /* product */
+	{ 4, 4, 0x86 }, /* time_created */
+};
+
+static const uint8_t fitDevIdDef[][3] = {
+	{ 3, 1, 0x02 }, /* developer_data_index */
+};
+
+static const uint8_t fitFieldDescDef[][3] = {
+	{ 0, 1, 0x02 }, /* developer_data_index */
+	{ 1, 1, 0x02 }, /* field_definition_number */
+	{ 2, 1, 0x02 }, /* fit_base_type_id */
+	{ 3, 8, 0x07 }, /* field_name */
+	{ 8, 4, 0x07 }, /* units */
+};
+
+static const uint8_t fitRecordDef[][3] = {
+	{ 253, 4, 0x86 }, /* timestamp */
+	{ 0, 4, 0x85 }, /* position_lat, semicircles */
+	{ 1, 4, 0x85 }, /* position_long */
+	{ 2, 2, 0x84 }, /* altitude, (m+500)*5 */
+	{ 3, 1, 0x02 }, /* heart_rate */
+	{ 5, 4, 0x86 }, /* distance, cm */
+	{ 6, 2, 0x84 }, /* speed, mm/s */
+};
+
+static const uint8_t fitLapDef[][3] = {
+	{ 253, 4, 0x86 }, /* timestamp */
+	{ 0, 1, 0x00 }, /* event */
+	{ 1, 1, 0x00 }, /* event_type */
+	{ 2, 4, 0x86 }, /* start_time */
+	{ 3, 4, 0x85 }, /* start_position_lat */
+	{ 4, 4, 0x85 }, /* start_position_long */
+	{ 7, 4, 0x86 }, /* total_elapsed_time, ms */
+	{ 8, 4, 0x86 }, /* total_timer_time, ms */
+	{ 9, 4, 0x86 }, /* total_distance, cm */
+	{ 14, 2, 0x84 }, /* max_speed */
+	{ 15, 1, 0x02 }, /* avg_heart_rate */
+	{ 16, 1, 0x02 }, /* max_heart_rate */
+};
+
+static const uint8_t fitSessionDef[][3] = {
+	{ 253, 4, 0x86 }, /* timestamp */
+	{ 0, 1, 0x00 }, /* event */
+	{ 1, 1, 0x00 }, /* event_type */
+	{ 2, 4, 0x86 }, /* start_time */
+	{ 3, 4, 0x85 }, /* start_position_lat */
+	{ 4, 4, 0x85 }, /* start_position_long */
+	{ 5, 1, 0x00 }, /* sport */
+	{ 7, 4, 0x86 }, /* total_elapsed_time */
+	{ 8, 4, 0x86 }, /* total_timer_time */
+	{ 9, 4, 0x86 }, /* total_distance */
+	{ 15, 2, 0x84 }, /* max_speed */
+	{ 16, 1, 0x02 }, /* avg_heart_rate */
+	{ 17, 1, 0x02 }, /* max_heart_rate */
+	{ 25, 2, 0x84 }, /* first_lap_index */
+	{ 26, 2, 0x84 }, /* num_laps */
+};
+
+static const uint8_t fitActivityDef[][3] = {
+	{ 253, 4, 0x86 }, /* timestamp */
+	{ 0, 4, 0x86 }, /* total_timer_time */
+	{ 1, 2, 0x84 }, /* num_sessions */
+	{ 2, 1, 0x00 }, /* type */
+	{ 3, 1, 0x00 }, /* event */
+	{ 4, 1, 0x00 }, /* event_type */
+};
+
+static uint16_t fitCrc(uint16_t crc, const uint8_t p[], const size_t len) {
+	static const uint16_t tab[16] = {
+		0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+		0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+	};
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		crc = ((crc >> 4) & 0x0FFF) ^ tab[crc & 0xF] ^ tab[p[i] & 0xF];
+		crc = ((crc >> 4) & 0x0FFF) ^ tab[crc & 0xF] ^ tab[p[i] >> 4];
+	}
+	return crc;
+}
+
+static void fitPut(FILE* f, uint32_t v, const unsigned size) {
+	unsigned i;
+
+	for (i = 0; i < size; i++, v >>= 8) {
+		fputc(v & 0xFF,f);
+	}
+}
+
+/* definition message, ndev developer fields (all from developer 0)
+ * follow the normal ones */
+static void fitDef(FILE* f, const uint8_t local, const uint16_t global,
+		   const uint8_t fd[][3], const unsigned n,
+		   const uint8_t dev[][3], const unsigned ndev) {
+	unsigned i;
+
+	fputc(0x40 | (ndev ? 0x20 : 0) | local,f);
+	fputc(0,f); /* reserved */
+	fputc(0,f); /* little endian */
+	fitPut(f,global,2);
+	fputc(n,f);
+	for (i = 0; i < n; i++) {
+		fwrite(fd[i],1,3,f);
+	}
+	if (ndev) {
+		fputc(ndev,f);
+		for (i = 0; i < ndev; i++) {
+			fwrite(dev[i],1,3,f);
+		}
+	}
+}
+
+#define FITDEF(f,local,global,fd) \
+	fitDef(f,local,global,fd,sizeof(fd)/sizeof(fd[0]),NULL,0)
+
+static int32_t fitSemicircles(const float deg) {
+	return (int32_t)(deg*(2147483648.0/180));
+}
+
+static void fitTrackStart(struct sink* s) {
+	struct fitpriv* fp = s->priv;
+
+	if (!fp) {
+		fp = s->priv = malloc(sizeof(struct fitpriv));
+	}
+	memset(fp,0,sizeof(*fp));
+}
+
+static void fitPoint(struct sink* s, const wpcols* c, const unsigned i,
+		     const waypoint __attribute__((unused)) *wp,
+		     const struct tm __attribute__((unused)) *ptm) {
+	static const uint8_t headingDev[][3] = { { 0, 2, 0 } };
+	struct fitpriv* fp = s->priv;
+	const uint32_t t = c->ts[i] - fit_epoch;
+	const int32_t lat = fitSemicircles(c->lat[i]);
+	const int32_t lon = fitSemicircles(c->lon[i]);
+	/* tenths of km/h to mm/s, 0xFFFF is invalid */
+	const uint16_t speed = MIN(c->speed[i]*1000u/36,UINT16_MAX-1);
+	FILE* f;
+
+	if (!s->npts) {
+		f = fp->mf = open_memstream(&fp->buf,&fp->len);
+		FITDEF(f,FIT_FILE_ID,0,fitFileIdDef);
+		fputc(FIT_FILE_ID,f);
+		fitPut(f,4,1); /* activity */
+		fitPut(f,255,2); /* development */
+		fitPut(f,260,2);
+		fitPut(f,t,4);
+		/* heading has no native record field */
+		FITDEF(f,FIT_DEV_ID,207,fitDevIdDef);
+		fputc(FIT_DEV_ID,f);
+		fitPut(f,0,1);
+		FITDEF(f,FIT_FIELD_DESC,206,fitFieldDescDef);
+		fputc(FIT_FIELD_DESC,f);
+		fitPut(f,0,1);
+		fitPut(f,0,1);
+		fitPut(f,0x84,1);
+		fwrite("heading\0",1,8,f);
+		fwrite("deg\0",1,4,f);
+		fitDef(f,FIT_RECORD,20,fitRecordDef,
+		       sizeof(fitRecordDef)/sizeof(fitRecordDef[0]),headingDev,1);
+		fp->t0 = t;
+		fp->lat0 = lat;
+		fp->lon0 = lon;
+	}
+	f = fp->mf;
+	fputc(FIT_RECORD,f);
+	fitPut(f,t,4);
+	fitPut(f,lat,4);
+	fitPut(f,lon,4);
+	fitPut(f,(s->alt[i]+500)*5,2);
+	fitPut(f,c->hbr[i] ? MIN(c->hbr[i],254) : 0xFF,1);
+	fitPut(f,(c->dist[i]-s->dist0)*100,4);
+	fitPut(f,speed,2);
+	fitPut(f,c->heading[i],2);
+
+	fp->t1 = t;
+	fp->dist1 = c->dist[i]-s->dist0;
+	if (speed > fp->maxspeed)
+		fp->maxspeed = speed;
+	if (c->hbr[i]) {
+		if (c->hbr[i] > fp->maxhr)
+			fp->maxhr = MIN(c->hbr[i],254);
+		fp->hrsum += c->hbr[i];
+		fp->hrcnt++;
+	}
+}
+
+static void fitTrackEnd(struct sink* s) {
+	struct fitpriv* fp = s->priv;
+	const uint32_t elapsed = (s->ti ? s->ti->duration : fp->t1-fp->t0)*1000;
+	const uint32_t dist = (s->ti ? s->ti->length : fp->dist1)*100;
+	const uint8_t avghr = fp->hrcnt ? fp->hrsum/fp->hrcnt : 0xFF;
+	const uint8_t maxhr = fp->hrcnt ? fp->maxhr : 0xFF;
+	char fname[4096];
+	uint8_t hdr[14];
+	uint16_t crc;
+	FILE* f;
+
+	if (!s->npts) {
+		return;
+	}
+	f = fp->mf;
+	FITDEF(f,FIT_LAP,19,fitLapDef);
+	fputc(FIT_LAP,f);
+	fitPut(f,fp->t1,4);
+	fitPut(f,9,1); /* lap */
+	fitPut(f,1,1); /* stop */
+	fitPut(f,fp->t0,4);
+	fitPut(f,fp->lat0,4);
+	fitPut(f,fp->lon0,4);
+	fitPut(f,elapsed,4);
+	fitPut(f,elapsed,4);
+	fitPut(f,dist,4);
+	fitPut(f,fp->maxspeed,2);
+	fitPut(f,avghr,1);
+	fitPut(f,maxhr,1);
+	FITDEF(f,FIT_SESSION,18,fitSessionDef);
+	fputc(FIT_SESSION,f);
+	fitPut(f,fp->t1,4);
+	fitPut(f,8,1); /* session */
+	fitPut(f,1,1); /* stop */
+	fitPut(f,fp->t0,4);
+	fitPut(f,fp->lat0,4);
+	fitPut(f,fp->lon0,4);
+	fitPut(f,0,1); /* generic */
+	fitPut(f,elapsed,4);
+	fitPut(f,elapsed,4);
+	fitPut(f,dist,4);
+	fitPut(f,fp->maxspeed,2);
+	fitPut(f,avghr,1);
+	fitPut(f,maxhr,1);
+	fitPut(f,0,2);
+	fitPut(f,1,2);
+	FITDEF(f,FIT_ACTIVITY,34,fitActivityDef);
+	fputc(FIT_ACTIVITY,f);
+	fitPut(f,fp->t1,4);
+	fitPut(f,elapsed,4);
+	fitPut(f,1,2);
+	fitPut(f,0,1); /* manual */
+	fitPut(f,26,1); /* activity */
+	fitPut(f,1,1); /* stop */
+	fclose(f);
+
+	hdr[0] = sizeof(hdr);
+	hdr[1] = 0x20; /* protocol 2.0, needed for developer fields */
+	hdr[2] = 2132 & 0xFF; /* profile version */
+	hdr[3] = 2132 >> 8;
+	hdr[4] = fp->len;
+	hdr[5] = fp->len >> 8;
+	hdr[6] = fp->len >> 16;
+	hdr[7] = fp->len >> 24;
+	memcpy(hdr+8,".FIT",4);
+	crc = fitCrc(0,hdr,12);
+	hdr[12] = crc;
+	hdr[13] = crc >> 8;
+	crc = fitCrc(fitCrc(0,hdr,sizeof(hdr)),(uint8_t*)fp->buf,fp->len);
+
+	if (!s->source) {
+		snprintf(fname,sizeof(fname),"%s/track-%d.fit",s->path,s->tracknum);
+		f = fopen(fname,"w");
+	} else { /* merged: a track resumed after another dump's points
+		  * goes to <src>-track-<n>-2.fit and so on */
+		unsigned k = 1;
+
+		do {
+			snprintf(fname,sizeof(fname),k > 1 ? "%s/%s-track-%d-%u.fit"
+				 : "%s/%s-track-%d.fit",s->path,s->source,s->tracknum,k);
+		} while (!(f = fopen(fname,"wx")) && errno == EEXIST && ++k);
+	}
+	if (!f) {
+		perror(fname);
+	} else {
+		fwrite(hdr,1,sizeof(hdr),f);
+		fwrite(fp->buf,1,fp->len,f);
+		fitPut(f,crc,2);
+		fclose(f);
+	}
+	free(fp->buf);
+}
+
+static void fitFooter(struct sink* s,
+		      const struct plist __attribute__((unused)) *poilist) {
+	free(s->priv);
+}
+
+/* one json object per line, flushed per block so readers can follow
+ * a download in progress */
+static void ndjsonTrackInfo(struct sink* s, const struct tlist* tl) {
+	const trackinfo* ti = &tl->ti;
+	time_t t = ti->timestamp + ts_offset;
+	struct tm tm;
+	char tbuf[64];
+	unsigned i;
+
+	strftime(tbuf,sizeof(tbuf),"%FT%TZ",gmtime_r(&t,&tm));
+	fprintf(s->f,"{\"type\":\"track\",\"num\":%u,\"name\":\"",tl->num);
+	for (i = 0; i < sizeof(ti->name) && ti->name[i] && ti->name[i] != '\377'; i++) {
+		const unsigned char c = ti->name[i];
+
+		if (c == '"' || c == '\\') {
+			fprintf(s->f,"\\%c",c);
+		} else if (c < 32 || c > 126) {
+			fprintf(s->f,"\\u%04x",c);
+		} else {
+			fputc(c,s->f);
+		}
+	}
+	fprintf(s->f,"\",\"time\":\"%s\",\"duration\":%u,\"length\":%u,"
+		"\"start\":%u,\"size\":%u}\n",
+		tbuf,ti->duration,ti->length,ti->start_addr,ti->size);
+}
+
+static void ndjsonPoint(struct sink* s, const wpcols* c, const unsigned i,
+			const waypoint __attribute__((unused)) *wp,
+			const struct tm* ptm) {
+	char tbuf[64];
+
+	strftime(tbuf,sizeof(tbuf),"%FT%TZ",ptm);
+	fprintf(s->f,"{\"type\":\"wpt\",\"track\":%u,\"time\":\"%s\",\"lat\":%.7f,"
+		"\"lon\":%.7f,\"ele\":%d,\"speed\":%.6f,\"course\":%d,\"hr\":%d,"
+		"\"dist\":%u,\"poi\":%s%s%s%s}\n",
+		s->tracknum,tbuf,c->lat[i],c->lon[i],
+		s->alt[i],c->speed[i]/36.,
+		c->heading[i],c->hbr[i],c->dist[i],
+		(c->poi[i/8] >> (i%8)) & 1 ? "true" : "false",
+		s->source ? ",\"device\":\"" : "",s->source ? s->source : "",
+		s->source ? "\"" : "");
+}
+
+static const struct sink sinkfmts[] = {
+	{ .fmt = "txt", .parallel = 1, .point = txtPoint },
+	{ .fmt = "gpx", .parallel = 1, .pois = 1, .header = gpxHeader, .trackStart = gpxTrackStart,
+	  .point = gpxPoint, .trackEnd = gpxTrackEnd, .footer = gpxFooter, .append = gpxAppend },
+	{ .fmt = "csv", .parallel = 1, .header = csvHeader, .point = csvPoint },
+	{ .fmt = "geojson", .pois = 1, .header = geojsonHeader, .point = geojsonPoint,
+	  .footer = geojsonFooter },
+	{ .fmt = "kml", .pois = 1, .header = kmlHeader, .trackStart = kmlTrackStart,
+	  .point = kmlPoint, .trackEnd = kmlTrackEnd, .footer = kmlFooter },
+	{ .fmt = "tcx", .header = tcxHeader, .point = tcxPoint,
+	  .trackEnd = tcxTrackEnd, .footer = tcxFooter },
+	{ .fmt = "ndjson", .flushblock = 1, .trackInfo = ndjsonTrackInfo,
+	  .point = ndjsonPoint },
+	{ .fmt = "fit", .multifile = 1, .trackStart = fitTrackStart,
+	  .point = fitPoint, .trackEnd = fitTrackEnd, .footer = fitFooter },
+	{ .fmt = "arrow", .multifile = 1, .trackInfo = columnarTrackInfo,
+	  .point = columnarPoint, .footer = columnarFooter },
+	{ .fmt = "parquet", .multifile = 1, .trackInfo = columnarTrackInfo,
+	  .point = columnarPoint, .footer = columnarFooter },
+	{ .fmt = "lod", .trackStart = lodTrackStart, .point = lodPoint,
+	  .trackEnd = lodTrackEnd, .footer = lodFooter },
+#ifdef HAVE_SQLITE
+	{ .fmt = "sqlite", .multifile = 1, .trackStart = sqliteTrackStart,
+	  .point = sqlitePoint, .footer = sqliteFooter },
+#endif
+	{ .fmt = NULL }
+};
+
+/* connects to a listening unix stream socket */
+static FILE* unixOpen(const char path[]) {
+	struct sockaddr_un sa;
+	FILE* f;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr,"%s: path too long\n",path);
+		return NULL;
+	}
+	memset(&sa,0,sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path,path);
+	fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if (fd < 0 || connect(fd,(struct sockaddr*)&sa,sizeof(sa)) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	/* reader going away shows up as write error, not a signal */
+	signal(SIGPIPE,SIG_IGN);
+	if ((f = fdopen(fd,"w")))
+		setvbuf(f,NULL,_IOFBF,1<<16);
+	return f;
+}
+
+/* opens <format>:<file> ("-" is stdout, unix:<path> a unix socket) and
+ * appends it to the list, for per-track formats <file> is a directory */
+int sinkOpen(struct sink** sl, const char fmt[], const char path[],
+	     const int usealtbar) {
+	const struct sink* sf;
+	struct sink* ns;
+
+	for (sf = sinkfmts; sf->fmt; sf++) {
+		if (!strcmp(sf->fmt,fmt))
+			break;
+	}
+	if (!sf->fmt) {
+		fprintf(stderr,"unknown format: %s\n",fmt);
+		return -1;
+	}
+	ns = malloc(sizeof(struct sink));
+	*ns = *sf;
+	ns->usealtbar = usealtbar;
+	ns->path = strdup(path);
+	if (ns->multifile) {
+		ns->f = NULL;
+	} else if (!strncmp(path,"unix:",5)) {
+		ns->f = unixOpen(path+5);
+	} else if (!strncmp(path,"append:",7)) {
+		if (!ns->append)
+			fprintf(stderr,"%s can't append\n",fmt);
+		else
+			ns->f = ns->append(ns,path+7);
+	} else if (!(ns->f = strcmp(path,"-") ? sinkFopen(path,"w") : stdout)) {
+		perror(path);
+	}
+	if (!ns->f && !ns->multifile) {
+		free(ns->path);
+		free(ns);
+		return -1;
+	}
+	while (*sl) {
+		sl = &(*sl)->next;
+	}
+	*sl = ns;
+	return 0;
+}
+
+const trackinfo* trackByNum(const struct tlist* tl, const unsigned num) {
+	for (; tl; tl = tl->prev) {
+		if (tl->num == num) {
+			return &tl->ti;
+		}
+	}
+	return NULL;
+}
+
+/* bytes as latin-1, like the \u escapes of ndjson */
+void trackNameUtf8(const trackinfo* ti, char name[TRACK_NAME_UTF8]) {
+	unsigned i;
+
+	for (i = 0; i < sizeof(ti->name) && ti->name[i] && ti->name[i] != '\377'; i++) {
+		const unsigned char c = ti->name[i];
+
+		if (c < 0x80) {
+			*name++ = c;
+		} else {
+			*name++ = 0xC0 | c >> 6;
+			*name++ = 0x80 | (c & 0x3F);
+		}
+	}
+	*name = '\0';
+}
+
+void sinksTrackStart(struct sink* sl, const unsigned tracknum,
+		     const struct tlist* tl) {
+	const trackinfo* const ti = trackByNum(tl,tracknum);
+
+	for (; sl; sl = sl->next) {
+		sl->tracknum = tracknum;
+		sl->ti = ti;
+		sl->npts = 0;
+		if (sl->trackStart)
+			sl->trackStart(sl);
+	}
+}
+
+/* new track list entries from..tl, passed oldest first */
+void sinksTrackInfo(struct sink* sl, const struct tlist* tl,
+		    const struct tlist* const from) {
+	if (tl == from) {
+		return;
+	}
+	sinksTrackInfo(sl,tl->prev,from);
+	for (; sl; sl = sl->next) {
+		if (sl->trackInfo)
+			sl->trackInfo(sl,tl);
+	}
+}
+
+void sinksFlush(struct sink* sl) {
+	for (; sl; sl = sl->next) {
+		if (sl->flushblock)
+			fflush(sl->f);
+		PROBE(flush,sl->fmt,sl->flushblock);
+	}
+}
+
+void sinksTrackEnd(struct sink* sl) {
+	for (; sl; sl = sl->next) {
+		if (sl->trackEnd)
+			sl->trackEnd(sl);
+	}
+}
+
+/* finishes the documents if anything was written and closes the files */
+void sinksClose(struct sink* sl, const int started,
+		const struct plist* poilist) {
+	while (sl) {
+		struct sink* next = sl->next;
+
+		if (started) {
+			if (sl->trackEnd)
+				sl->trackEnd(sl);
+			if (sl->footer)
+				sl->footer(sl,poilist);
+		}
+		if (sl->f == stdout) {
+			fflush(sl->f);
+		} else if (sl->f) {
+			fclose(sl->f);
+		}
+		free(sl->path);
+		free(sl);
+		sl = next;
+	}
+}
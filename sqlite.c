@@ -0,0 +1,276 @@
+/* sqlite catalogue: devices, tracks and their waypoints.  A track that
+ * is already in (same device, time and start_addr) is skipped, so
+ * loading the same dump again costs one lookup per track.  Points go in
+ * through a prepared statement, SQL_BATCH or more per transaction,
+ * committed at track boundaries; the indexes are made after the load. */
+#ifdef HAVE_SQLITE
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "gr260int.h"
+
+#define SQL_BATCH 100000
+
+static const char sqlSchema[] =
+	"CREATE TABLE IF NOT EXISTS devices ("
+	" id INTEGER PRIMARY KEY,"
+	" model TEXT NOT NULL UNIQUE," /* $PHLX852, there is no serial number */
+	" firmware INTEGER NOT NULL);" /* $PHLX861, of the last load */
+	"CREATE TABLE IF NOT EXISTS tracks ("
+	" id INTEGER PRIMARY KEY,"
+	" device INTEGER NOT NULL REFERENCES devices(id),"
+	" num INTEGER NOT NULL,"
+	" name TEXT,"
+	" time INTEGER," /* unix time */
+	" duration INTEGER, length INTEGER, start_addr INTEGER, size INTEGER,"
+	" unk0 INTEGER, unk1 INTEGER, unk2 INTEGER, unk3 INTEGER, unk4 INTEGER,"
+	" unk5 INTEGER, unk6 INTEGER, unk7 INTEGER, unk8 INTEGER, unk9 INTEGER,"
+	" points INTEGER," /* NULL until all are in */
+	" UNIQUE (device, time, start_addr));"
+	"CREATE TABLE IF NOT EXISTS waypoints ("
+	" track INTEGER NOT NULL REFERENCES tracks(id),"
+	" time INTEGER NOT NULL,"
+	" lat REAL, lon REAL," /* NaN is NULL */
+	" altgps INTEGER, altbar INTEGER, speed INTEGER, heading INTEGER,"
+	" hbr INTEGER, dist INTEGER, is_poi INTEGER,"
+	" unk1 INTEGER, unk2 INTEGER, unk7 INTEGER);";
+
+static const char sqlIndexes[] =
+	"CREATE INDEX IF NOT EXISTS waypoints_track ON waypoints(track, time);"
+	"CREATE INDEX IF NOT EXISTS waypoints_time ON waypoints(time);";
+
+struct sqlpriv {
+	sqlite3* db;
+	sqlite3_stmt* point;
+	sqlite3_int64 device;
+	sqlite3_int64 track; /* 0 while skipping a track that is in already */
+	const trackinfo* ti;
+	unsigned npts; /* of the current track */
+	unsigned pending; /* points in the open transaction */
+	int failed;
+};
+
+static int sqlError(const struct sink* const s, const struct sqlpriv* const sp) {
+	fprintf(stderr,"%s: %s\n",s->path,sqlite3_errmsg(sp->db));
+	return -1;
+}
+
+/* prepares sql, binds the int64 args in order and steps once;
+ * returns the sqlite3_step() result or -1 */
+static int sqlRun(const struct sink* const s, struct sqlpriv* const sp,
+		  sqlite3_stmt** const out, const char sql[], const unsigned n,
+		  const sqlite3_int64 args[]) {
+	sqlite3_stmt* st;
+	unsigned i;
+	int rc;
+
+	if (sqlite3_prepare_v2(sp->db,sql,-1,&st,NULL) != SQLITE_OK) {
+		return sqlError(s,sp);
+	}
+	for (i = 0; i < n; i++) {
+		sqlite3_bind_int64(st,i+1,args[i]);
+	}
+	rc = sqlite3_step(st);
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		sqlError(s,sp);
+		rc = -1;
+	}
+	if (out && rc == SQLITE_ROW) {
+		*out = st;
+	} else {
+		sqlite3_finalize(st);
+	}
+	return rc;
+}
+
+static int sqlExec(const struct sink* const s, struct sqlpriv* const sp,
+		   const char sql[]) {
+	if (sqlite3_exec(sp->db,sql,NULL,NULL,NULL) != SQLITE_OK) {
+		return sqlError(s,sp);
+	}
+	return 0;
+}
+
+static int sqlDevice(const struct sink* const s, struct sqlpriv* const sp) {
+	static const char* const sql[] = {
+		"INSERT OR IGNORE INTO devices(model,firmware) VALUES(?1,?2)",
+		"UPDATE devices SET firmware=?2 WHERE model=?1",
+		"SELECT id FROM devices WHERE model=?1",
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(sql)/sizeof(sql[0]); i++) {
+		sqlite3_stmt* st;
+		int rc;
+
+		if (sqlite3_prepare_v2(sp->db,sql[i],-1,&st,NULL) != SQLITE_OK) {
+			return sqlError(s,sp);
+		}
+		sqlite3_bind_text(st,1,s->model,-1,SQLITE_STATIC);
+		if (sqlite3_bind_parameter_count(st) > 1)
+			sqlite3_bind_int64(st,2,s->fwver);
+		rc = sqlite3_step(st);
+		if (rc == SQLITE_ROW) {
+			sp->device = sqlite3_column_int64(st,0);
+		}
+		sqlite3_finalize(st);
+		if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+			return sqlError(s,sp);
+		}
+	}
+	return 0;
+}
+
+/* opened at the first track, by then gr260dl knows the device */
+static struct sqlpriv* sqlPriv(struct sink* const s) {
+	struct sqlpriv* sp = s->priv;
+
+	if (sp) {
+		return sp;
+	}
+	sp = s->priv = calloc(1,sizeof(struct sqlpriv));
+	if (sqlite3_open(s->path,&sp->db) != SQLITE_OK
+	    || sqlExec(s,sp,sqlSchema) < 0
+	    || sqlExec(s,sp,"BEGIN") < 0
+	    || sqlDevice(s,sp) < 0
+	    || sqlite3_prepare_v2(sp->db,"INSERT INTO waypoints VALUES"
+				  "(?,?,?,?,?,?,?,?,?,?,?,?,?,?)",-1,&sp->point,NULL) != SQLITE_OK) {
+		sqlError(s,sp);
+		sp->failed = 1;
+	}
+	return sp;
+}
+
+/* points counted, so the track isn't loaded again */
+static void sqlTrackDone(const struct sink* const s, struct sqlpriv* const sp) {
+	const sqlite3_int64 args[] = { sp->npts, sp->track };
+
+	if (sp->track) {
+		sqlRun(s,sp,NULL,"UPDATE tracks SET points=?1 WHERE id=?2",2,args);
+	}
+	sp->track = 0;
+}
+
+void sqliteTrackStart(struct sink* s) {
+	struct sqlpriv* const sp = sqlPriv(s);
+	const trackinfo* const ti = s->ti;
+	sqlite3_stmt* st = NULL;
+	char name[TRACK_NAME_UTF8];
+
+	if (sp->failed) {
+		return;
+	}
+	sqlTrackDone(s,sp); /* a newer one follows, so it's complete */
+	if (sp->pending >= SQL_BATCH) {
+		sqlExec(s,sp,"COMMIT; BEGIN");
+		sp->pending = 0;
+	}
+	sp->ti = ti;
+	sp->npts = 0;
+	if (ti) {
+		const sqlite3_int64 key[] = { sp->device, ti->timestamp+ts_offset,
+					      ti->start_addr };
+
+		if (sqlRun(s,sp,&st,"SELECT id, points FROM tracks WHERE device=?"
+			   " AND time=? AND start_addr=?",3,key) == SQLITE_ROW) {
+			const sqlite3_int64 id = sqlite3_column_int64(st,0);
+			const int done = sqlite3_column_type(st,1) != SQLITE_NULL;
+
+			sqlite3_finalize(st);
+			if (done) {
+				return;
+			}
+			/* cut short last time */
+			sqlRun(s,sp,NULL,"DELETE FROM waypoints WHERE track=?",1,&id);
+			sqlRun(s,sp,NULL,"DELETE FROM tracks WHERE id=?",1,&id);
+		}
+	}
+	if (sqlite3_prepare_v2(sp->db,"INSERT INTO tracks VALUES(NULL,?,?,?,?,?,?,?,?,"
+			       "?,?,?,?,?,?,?,?,?,?,NULL)",-1,&st,NULL) != SQLITE_OK) {
+		sqlError(s,sp);
+		return;
+	}
+	sqlite3_bind_int64(st,1,sp->device);
+	sqlite3_bind_int64(st,2,s->tracknum);
+	if (ti) {
+		trackNameUtf8(ti,name);
+		sqlite3_bind_text(st,3,name,-1,SQLITE_STATIC);
+		sqlite3_bind_int64(st,4,ti->timestamp+ts_offset);
+		sqlite3_bind_int64(st,5,ti->duration);
+		sqlite3_bind_int64(st,6,ti->length);
+		sqlite3_bind_int64(st,7,ti->start_addr);
+		sqlite3_bind_int64(st,8,ti->size);
+		sqlite3_bind_int64(st,9,ti->unk0);
+		sqlite3_bind_int64(st,10,ti->unk1);
+		sqlite3_bind_int64(st,11,ti->unk2);
+		sqlite3_bind_int64(st,12,ti->unk3);
+		sqlite3_bind_int64(st,13,ti->unk4);
+		sqlite3_bind_int64(st,14,ti->unk5);
+		sqlite3_bind_int64(st,15,ti->unk6);
+		sqlite3_bind_int64(st,16,ti->unk7);
+		sqlite3_bind_int64(st,17,ti->unk8);
+		sqlite3_bind_int64(st,18,ti->unk9);
+	} /* else NULLs, such a track is never matched again */
+	if (sqlite3_step(st) == SQLITE_DONE) {
+		sp->track = sqlite3_last_insert_rowid(sp->db);
+	} else {
+		sqlError(s,sp);
+	}
+	sqlite3_finalize(st);
+}
+
+void sqlitePoint(struct sink* s, const wpcols* c, const unsigned i,
+		 const waypoint* wp, const struct tm __attribute__((unused)) *ptm) {
+	struct sqlpriv* const sp = s->priv;
+	sqlite3_stmt* const st = sp->point;
+
+	if (!sp->track) {
+		return;
+	}
+	sqlite3_bind_int64(st,1,sp->track);
+	sqlite3_bind_int64(st,2,c->ts[i]);
+	sqlite3_bind_double(st,3,c->lat[i]);
+	sqlite3_bind_double(st,4,c->lon[i]);
+	sqlite3_bind_int(st,5,c->altgps[i]);
+	sqlite3_bind_int(st,6,c->altbar[i]);
+	sqlite3_bind_int(st,7,c->speed[i]);
+	sqlite3_bind_int(st,8,c->heading[i]);
+	sqlite3_bind_int(st,9,c->hbr[i]);
+	sqlite3_bind_int64(st,10,c->dist[i]);
+	sqlite3_bind_int(st,11,wp->is_poi);
+	sqlite3_bind_int(st,12,wp->unk1);
+	sqlite3_bind_int(st,13,wp->unk2);
+	sqlite3_bind_int64(st,14,wp->unk7);
+	if (sqlite3_step(st) != SQLITE_DONE) {
+		sqlError(s,sp);
+		sp->track = 0;
+	}
+	sqlite3_reset(st);
+	sp->npts++;
+	sp->pending++;
+}
+
+void sqliteFooter(struct sink* s,
+		  const struct plist __attribute__((unused)) *poilist) {
+	struct sqlpriv* const sp = s->priv;
+
+	if (!sp) {
+		return;
+	}
+	if (!sp->failed) {
+		/* the last track may have been cut short by the download */
+		if (sp->ti && sp->npts < sp->ti->size) {
+			sp->track = 0;
+		}
+		sqlTrackDone(s,sp);
+		if (sqlExec(s,sp,"COMMIT") == 0) {
+			sqlExec(s,sp,sqlIndexes);
+		}
+	}
+	sqlite3_finalize(sp->point);
+	sqlite3_close(sp->db);
+	free(sp);
+	s->priv = NULL;
+}
+#endif
@@ -0,0 +1,271 @@
+/* content addressed block store: every received block is kept once
+ * under blocks/<sha256>, a pull is a manifest listing its blocks */
+#define _GNU_SOURCE /* syncfs() */
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+#define MANIFEST_MAGIC "gr260 manifest 1\n"
+
+#define DIR_MAX (PATH_MAX-128) /* room for the block and manifest names */
+
+struct blockstore {
+	char dir[DIR_MAX];
+	char man[PATH_MAX];
+	FILE* f;
+	unsigned nnew, ndup;
+};
+
+/*** sha256, FIPS 180-4 ***/
+
+static const uint32_t sha256k[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+#define ROR(x,n) ((x) >> (n) | (x) << (32-(n)))
+
+static void sha256Block(uint32_t h[8], const unsigned char p[64]) {
+	uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = (uint32_t)p[4*i] << 24 | p[4*i+1] << 16 | p[4*i+2] << 8 | p[4*i+3];
+	}
+	for (; i < 64; i++) {
+		w[i] = w[i-16]+(ROR(w[i-15],7)^ROR(w[i-15],18)^(w[i-15] >> 3))
+		      +w[i-7]+(ROR(w[i-2],17)^ROR(w[i-2],19)^(w[i-2] >> 10));
+	}
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; k = h[7];
+	for (i = 0; i < 64; i++) {
+		t1 = k+(ROR(e,6)^ROR(e,11)^ROR(e,25))+((e & f)^(~e & g))+sha256k[i]+w[i];
+		t2 = (ROR(a,2)^ROR(a,13)^ROR(a,22))+((a & b)^(a & c)^(b & c));
+		k = g; g = f; f = e; e = d+t1;
+		d = c; c = b; b = a; a = t1+t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256Hex(const void* buf, const size_t len, char hex[65]) {
+	uint32_t h[8] = {
+		0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
+		0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+	};
+	const unsigned char* p = buf;
+	unsigned char tail[128] = { 0 };
+	size_t left = len, ntail;
+	int i;
+
+	for (; left >= 64; left -= 64, p += 64) {
+		sha256Block(h,p);
+	}
+	memcpy(tail,p,left);
+	tail[left] = 0x80;
+	ntail = left < 56 ? 64 : 128;
+	for (i = 0; i < 8; i++) {
+		tail[ntail-1-i] = (uint64_t)len*8 >> 8*i;
+	}
+	sha256Block(h,tail);
+	if (ntail == 128) {
+		sha256Block(h,tail+64);
+	}
+	for (i = 0; i < 8; i++) {
+		sprintf(hex+8*i,"%08x",h[i]);
+	}
+}
+
+/*** writing ***/
+
+static void blockPath(char path[PATH_MAX], const char dir[DIR_MAX], const char hex[65]) {
+	snprintf(path,PATH_MAX,"%s/blocks/%.2s/%s",dir,hex,hex+2);
+}
+
+/* the directory holding path, so that a rename into it survives a crash */
+static int syncDir(const char path[]) {
+	char dir[PATH_MAX];
+	int fd, rv;
+
+	snprintf(dir,sizeof(dir),"%.*s",(int)(strrchr(path,'/')-path),path);
+	if ((fd = open(dir,O_RDONLY|O_DIRECTORY)) < 0) {
+		return -1;
+	}
+	rv = fsync(fd);
+	close(fd);
+	return rv;
+}
+
+struct blockstore* storeOpen(const char dir[]) {
+	struct blockstore* const bs = calloc(1,sizeof(struct blockstore));
+	const time_t now = time(NULL);
+	char tmp[PATH_MAX+8], stamp[32];
+
+	snprintf(bs->dir,sizeof(bs->dir),"%s",dir);
+	snprintf(tmp,sizeof(tmp),"%s/blocks",bs->dir);
+	if ((mkdir(dir,0755) < 0 && errno != EEXIST)
+	    || (mkdir(tmp,0755) < 0 && errno != EEXIST)) {
+		free(bs);
+		return NULL;
+	}
+	strftime(stamp,sizeof(stamp),"%Y%m%d-%H%M%S",localtime(&now));
+	snprintf(bs->man,sizeof(bs->man),"%s/%s.man",bs->dir,stamp);
+	snprintf(tmp,sizeof(tmp),"%s.tmp",bs->man);
+	if (!(bs->f = fopen(tmp,"w"))) {
+		free(bs);
+		return NULL;
+	}
+	fputs(MANIFEST_MAGIC,bs->f);
+	return bs;
+}
+
+/* the size/checksum pair preceding the track list and the data */
+void storeHeader(struct blockstore* const bs, const int32_t size, const uint32_t chksum) {
+	fprintf(bs->f,"h %d %08X\n",size,chksum);
+}
+
+/* crc < 0 if the device didn't report one (replayed from a dump) */
+int storeBlock(struct blockstore* const bs, const void* buf, const int len,
+	       const int64_t crc) {
+	char hex[65], path[PATH_MAX], tmp[PATH_MAX+4];
+	FILE* f;
+
+	sha256Hex(buf,len,hex);
+	if (crc < 0) {
+		fprintf(bs->f,"b %s %d -\n",hex,len);
+	} else {
+		fprintf(bs->f,"b %s %d %08X\n",hex,len,(unsigned)crc);
+	}
+	blockPath(path,bs->dir,hex);
+	if (!access(path,F_OK)) {
+		bs->ndup++;
+		return 0;
+	}
+	snprintf(tmp,sizeof(tmp),"%.*s",(int)(strrchr(path,'/')-path),path);
+	mkdir(tmp,0755);
+	snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+	if (!(f = fopen(tmp,"w"))) {
+		return -1;
+	}
+	if (fwrite(buf,len,1,f) != 1 || fclose(f)) {
+		unlink(tmp);
+		return -1;
+	}
+	bs->nnew++;
+	return rename(tmp,path); /* synced by storeClose() */
+}
+
+/* publishes the manifest of a complete pull, otherwise drops it;
+ * the blocks stay, a later pull will reference them */
+int storeClose(struct blockstore* const bs, const int commit, const int verbose) {
+	char tmp[PATH_MAX+4];
+	int rv = 0;
+
+	snprintf(tmp,sizeof(tmp),"%s.tmp",bs->man);
+	/* the new blocks and their directories, with the manifest, reach
+	 * the disk before the manifest is published */
+	if (fflush(bs->f) || (commit && syncfs(fileno(bs->f)) < 0)) {
+		rv = -1;
+	}
+	fclose(bs->f);
+	if (commit && !rv) {
+		rv = rename(tmp,bs->man) < 0 ? -1 : syncDir(bs->man);
+		if (verbose && !rv) {
+			fprintf(stderr,"%s: %u new, %u known blocks\n",bs->man,bs->nnew,bs->ndup);
+		}
+	} else {
+		unlink(tmp);
+	}
+	free(bs);
+	return rv;
+}
+
+/*** reading ***/
+
+int isManifest(const void* base, const size_t len) {
+	return len >= sizeof(MANIFEST_MAGIC)-1
+	       && !memcmp(base,MANIFEST_MAGIC,sizeof(MANIFEST_MAGIC)-1);
+}
+
+/* assembles the dump a manifest describes, the blocks are looked up
+ * next to it; returns a malloc'd buffer, NULL on error */
+char* manifestLoad(const char path[], const char man[], const size_t mlen,
+		   size_t* const len) {
+	char dir[DIR_MAX], line[128], bpath[PATH_MAX], hex[65];
+	const char* p = man+sizeof(MANIFEST_MAGIC)-1;
+	const char* const end = man+mlen;
+	const char* slash = strrchr(path,'/');
+	char* buf = NULL;
+	size_t cap = 0;
+	int32_t size;
+	uint32_t chksum;
+	int blen;
+
+	if (slash) {
+		snprintf(dir,sizeof(dir),"%.*s",(int)(slash-path),path);
+	} else {
+		strcpy(dir,".");
+	}
+	*len = 0;
+	while (p < end) {
+		const char* const nl = memchr(p,'\n',end-p);
+		const size_t ll = (nl ? nl : end)-p;
+
+		snprintf(line,sizeof(line),"%.*s",(int)MIN(ll,sizeof(line)-1),p);
+		p += ll+1;
+		if (*len+BLOCK_SIZE > cap) {
+			char* const nbuf = realloc(buf,cap = cap*2+16*BLOCK_SIZE);
+
+			if (!nbuf) {
+				goto fail;
+			}
+			buf = nbuf;
+		}
+		if (sscanf(line,"h %d %X",&size,&chksum) == 2) {
+			memcpy(buf+*len,&size,4);
+			memcpy(buf+*len+4,&chksum,4);
+			*len += 8;
+		} else if (sscanf(line,"b %64[0-9a-f] %d",hex,&blen) == 2
+			   && blen > 0 && blen <= BLOCK_SIZE) {
+			FILE* f;
+
+			blockPath(bpath,dir,hex);
+			if (!(f = fopen(bpath,"r"))) {
+				goto fail;
+			}
+			if (fread(buf+*len,blen,1,f) != 1) {
+				fclose(f);
+				errno = EIO;
+				goto fail;
+			}
+			fclose(f);
+			sha256Hex(buf+*len,blen,bpath);
+			if (strcmp(bpath,hex)) { /* damaged */
+				errno = EIO;
+				goto fail;
+			}
+			*len += blen;
+		} else if (ll) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+	return buf;
+fail:
+	free(buf);
+	return NULL;
+}
@@ -0,0 +1,110 @@
+/* exports known points to FIT and checks the speed of their records,
+ * mm/s, clamped below 0xFFFF (invalid) */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../gr260.h"
+
+static const struct { uint16_t speed; uint16_t mms; } cases[] = {
+	{ 0, 0 },
+	{ 36, 1000 }, /* 3.6 km/h */
+	{ 360, 10000 },
+	{ 1234, 34277 },
+	{ 65535, 65534 },
+};
+#define NCASES (sizeof(cases)/sizeof(cases[0]))
+
+static unsigned get(const uint8_t* p, const unsigned n) {
+	unsigned v = 0, i;
+
+	for (i = n; i--; )
+		v = v << 8 | p[i];
+	return v;
+}
+
+int main(void) {
+	char dir[] = "/tmp/fitspeedXXXXXX", path[64];
+	gr260_waypoint wps[NCASES];
+	struct { unsigned size, speed, gmsg; } def[16];
+	uint8_t buf[4096];
+	unsigned i, n, pos, found = 0, fails = 0;
+	gr260_export* ex;
+	FILE* f;
+
+	memset(wps,0,sizeof(wps));
+	memset(def,0,sizeof(def));
+	for (i = 0; i < NCASES; i++) {
+		wps[i].timestamp = 600000000+i;
+		wps[i].lat = 49.5;
+		wps[i].lon = 19.5;
+		wps[i].speed = cases[i].speed;
+		wps[i].dist = 10*i;
+	}
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return 1;
+	}
+	ex = gr260_export_new();
+	if (gr260_export_add_sink(ex,"fit",dir)) {
+		return 1;
+	}
+	gr260_export_waypoints(ex,wps,sizeof(wps));
+	gr260_export_close(ex);
+
+	snprintf(path,sizeof(path),"%s/track-1.fit",dir);
+	f = fopen(path,"rb");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	n = fread(buf,1,sizeof(buf),f);
+	fclose(f);
+	unlink(path);
+	rmdir(dir);
+
+	for (pos = buf[0]; pos < n-2; ) {
+		const uint8_t h = buf[pos++];
+		const unsigned lt = h & 0xF;
+
+		if (h & 0x40) { /* definition */
+			const unsigned nf = buf[pos+4];
+			const uint8_t* fd = &buf[pos+5];
+
+			def[lt].gmsg = get(&buf[pos+2],2);
+			def[lt].size = 0;
+			def[lt].speed = ~0u;
+			for (i = 0; i < nf; i++, fd += 3) {
+				if (fd[0] == 6)
+					def[lt].speed = def[lt].size;
+				def[lt].size += fd[1];
+			}
+			pos += 5+3*nf;
+			if (h & 0x20) { /* developer fields */
+				const unsigned nd = buf[pos++];
+
+				for (i = 0; i < nd; i++)
+					def[lt].size += buf[pos+3*i+1];
+				pos += 3*nd;
+			}
+			continue;
+		}
+		if (def[lt].gmsg == 20 && def[lt].speed != ~0u && found < NCASES) {
+			const unsigned v = get(&buf[pos+def[lt].speed],2);
+
+			if (v != cases[found].mms) {
+				fprintf(stderr,"speed %u: %u mm/s, expected %u\n",
+					cases[found].speed,v,cases[found].mms);
+				fails++;
+			}
+			found++;
+		}
+		pos += def[lt].size;
+	}
+	if (found != NCASES) {
+		fprintf(stderr,"%u records, expected %u\n",found,(unsigned)NCASES);
+		fails++;
+	}
+	return fails != 0;
+}
@@ -0,0 +1,434 @@
+/* gr260dl -w: dumps dropped into watched directories go through the -o
+ * outputs, a few at a time.  Each is checked against its size headers,
+ * converted, noted in the directory's journal and
+ * renamed into done/ or failed/; the journal covers a restart between
+ * the last two steps, everything else in the directory is queued again. */
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gr260int.h"
+
+#define WATCH_JOURNAL ".gr260journal"
+
+struct job {
+	unsigned dir;
+	char name[NAME_MAX+1];
+	int busy;
+	struct job* next;
+};
+
+struct watch {
+	char* const* dirs;
+	int* journal; /* fd per directory */
+	const struct outspec* outs;
+	unsigned nouts;
+	const struct gr260_export* tmpl;
+	int shared; /* some output is added to by every dump */
+	pthread_mutex_t sharedlock;
+	pthread_mutex_t lock; /* jobs and quit */
+	pthread_cond_t cond;
+	struct job* jobs;
+	int quit;
+};
+
+static volatile sig_atomic_t gWatchQuit = 0;
+
+static void watchQuit(int __attribute__((unused)) sig) {
+	gWatchQuit = 1;
+}
+
+/* dot files, and checkpoints of -b downloads made right in the directory */
+static int watchIgnored(const char name[]) {
+	const size_t n = strlen(name);
+
+	return name[0] == '.' || (n > 5 && !strcmp(name+n-5,".ckpt"))
+		|| (n > 4 && !strcmp(name+n-4,".tmp"));
+}
+
+/* lock held; a name already waiting isn't queued twice */
+static void jobAdd(struct watch* const w, const unsigned dir, const char name[]) {
+	struct job** jp;
+
+	if (watchIgnored(name) || strlen(name) > NAME_MAX) {
+		return;
+	}
+	for (jp = &w->jobs; *jp; jp = &(*jp)->next) {
+		if ((*jp)->dir == dir && !(*jp)->busy && !strcmp((*jp)->name,name)) {
+			return;
+		}
+	}
+	*jp = calloc(1,sizeof(struct job));
+	(*jp)->dir = dir;
+	strcpy((*jp)->name,name);
+	pthread_cond_signal(&w->cond);
+}
+
+/* lock held; the first job whose file nobody is working on */
+static struct job* jobTake(struct watch* const w) {
+	struct job *j, *b;
+
+	for (j = w->jobs; j; j = j->next) {
+		if (j->busy) {
+			continue;
+		}
+		for (b = w->jobs; b; b = b->next) {
+			if (b->busy && b->dir == j->dir && !strcmp(b->name,j->name))
+				break;
+		}
+		if (!b) {
+			j->busy = 1;
+			return j;
+		}
+	}
+	return NULL;
+}
+
+static void jobDone(struct watch* const w, struct job* const j) {
+	struct job** jp;
+
+	for (jp = &w->jobs; *jp != j; jp = &(*jp)->next)
+		;
+	*jp = j->next;
+	free(j);
+	pthread_cond_broadcast(&w->cond);
+}
+
+static void watchScan(struct watch* const w, const unsigned dir) {
+	DIR* const dp = opendir(w->dirs[dir]);
+	struct dirent* de;
+
+	if (!dp) {
+		perror(w->dirs[dir]);
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	while ((de = readdir(dp))) {
+		if (de->d_type == DT_REG || de->d_type == DT_UNKNOWN) {
+			jobAdd(w,dir,de->d_name);
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+	closedir(dp);
+}
+
+static void watchMove(const struct watch* const w, const unsigned dir,
+		      const char name[], const int ok) {
+	char from[PATH_MAX], to[PATH_MAX];
+
+	snprintf(from,sizeof(from),"%s/%s",w->dirs[dir],name);
+	snprintf(to,sizeof(to),"%s/%s/%s",w->dirs[dir],ok ? "done" : "failed",name);
+	if (rename(from,to) < 0) {
+		perror(to);
+	}
+}
+
+/* the size headers have to match what follows them; the checksums are
+ * only warned about, the device's algorithm isn't known to be CRC-32 */
+static int watchCheck(const gr260_dump* const d, const char path[], char why[],
+		      const size_t n) {
+	int32_t tlsize, size;
+
+	if (d->len < 16) {
+		snprintf(why,n,"too short");
+		return -1;
+	}
+	memcpy(&tlsize,d->base,4);
+	if (tlsize < 0 || tlsize%sizeof(trackinfo) || (size_t)tlsize > d->len-16) {
+		snprintf(why,n,"track list size %d",tlsize);
+		return -1;
+	}
+	memcpy(&size,d->base+8+tlsize,4);
+	if (size < 0 || size%sizeof(waypoint) || (size_t)size > d->len-16-tlsize) {
+		snprintf(why,n,"data size %d",size);
+		return -1;
+	}
+	if ((size_t)16+tlsize+size != d->len && !d->index) {
+		snprintf(why,n,"%zu bytes after the data",d->len-16-tlsize-size);
+		return -1;
+	}
+	if (crc32Update(0,d->tracks,tlsize) != d->tlchksum) {
+		fprintf(stderr,"%s: track list checksum differs, converting anyway\n",path);
+	}
+	if (crc32Update(0,d->wps,size) != d->chksum) {
+		fprintf(stderr,"%s: data checksum differs, converting anyway\n",path);
+	}
+	return 0;
+}
+
+/* an output without %s gets every dump, so it has to add to what is
+ * there rather than start afresh: stdout, a unix socket, gpx:append
+ * or sqlite; -1 for the others, they would keep only the last dump */
+static int watchShared(const struct outspec* const o) {
+	if (strstr(o->path,"%s")) {
+		return 0;
+	}
+	if (!strcmp(o->path,"-") || !strncmp(o->path,"unix:",5)
+	    || (!strcmp(o->fmt,"gpx") && !strncmp(o->path,"append:",7))
+	    || !strcmp(o->fmt,"sqlite")) {
+		return 1;
+	}
+	return -1;
+}
+
+/* %s is the dump's name without extension, %% a % */
+static void watchPath(char out[PATH_MAX], const char tmpl[], const char name[]) {
+	const char* const dot = strrchr(name,'.');
+	const int stem = dot && dot != name ? dot-name : (int)strlen(name);
+	int n = 0;
+
+	for (; *tmpl && n < PATH_MAX-1; tmpl++) {
+		if (tmpl[0] == '%' && tmpl[1] == 's') {
+			n += snprintf(out+n,PATH_MAX-n,"%.*s",stem,name);
+			tmpl++;
+		} else {
+			out[n++] = *tmpl;
+			tmpl += tmpl[0] == '%' && tmpl[1] == '%';
+		}
+	}
+	out[MIN(n,PATH_MAX-1)] = '\0';
+}
+
+static int watchConvert(struct watch* const w, const char path[], const char name[],
+			char why[], const size_t n) {
+	gr260_dump* const d = gr260_dump_open(path);
+	gr260_export* ex;
+	char out[PATH_MAX];
+	unsigned i;
+	int rc = 0;
+
+	if (!d) {
+		snprintf(why,n,"%s",strerror(errno));
+		return -1;
+	}
+	if (watchCheck(d,path,why,n) < 0) {
+		gr260_dump_close(d);
+		return -1;
+	}
+	ex = gr260_export_new();
+	gr260_export_set_altbar(ex,w->tmpl->usealtbar);
+	gr260_export_set_rowgroup(ex,w->tmpl->rowgroup);
+	if (w->tmpl->dem) {
+		gr260_export_set_dem(ex,demDir(w->tmpl->dem));
+	}
+	gr260_export_set_threads(ex,1); /* the workers are the parallelism */
+	if (w->shared) {
+		pthread_mutex_lock(&w->sharedlock);
+	}
+	for (i = 0; i < w->nouts && !rc; i++) {
+		watchPath(out,w->outs[i].path,name);
+		if (gr260_export_add_sink(ex,w->outs[i].fmt,out) < 0) {
+			snprintf(why,n,"can't open the %s output",w->outs[i].fmt);
+			rc = -1;
+		}
+	}
+	if (!rc) {
+		gr260_export_tracklist(ex,d->tracks,d->ntracks*sizeof(trackinfo));
+		exportImage(ex,d->wps,d->nwps);
+		snprintf(why,n,"%zu tracks, %zu points",d->ntracks,d->nwps);
+	}
+	gr260_export_close(ex);
+	if (w->shared) {
+		pthread_mutex_unlock(&w->sharedlock);
+	}
+	gr260_dump_close(d);
+	return rc;
+}
+
+static void watchProcess(struct watch* const w, const unsigned dir, const char name[]) {
+	char path[PATH_MAX], why[128] = "";
+	struct stat st;
+	int ok;
+
+	snprintf(path,sizeof(path),"%s/%s",w->dirs[dir],name);
+	if (stat(path,&st) < 0 || !S_ISREG(st.st_mode)) {
+		return; /* moved on already */
+	}
+	ok = watchConvert(w,path,name,why,sizeof(why)) == 0;
+	dprintf(w->journal[dir],"%lld %lld %s %s\n",(long long)st.st_size,
+		(long long)st.st_mtime,ok ? "done" : "failed",name);
+	fdatasync(w->journal[dir]);
+	watchMove(w,dir,name,ok);
+	fprintf(stderr,"%s: %s, %s\n",path,ok ? "done" : "failed",why);
+}
+
+static void* watchWorker(void* arg) {
+	struct watch* const w = arg;
+	struct job* j;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->quit && !(j = jobTake(w))) {
+			pthread_cond_wait(&w->cond,&w->lock);
+		}
+		if (w->quit) { /* the rest is queued again on the next start */
+			break;
+		}
+		pthread_mutex_unlock(&w->lock);
+		watchProcess(w,j->dir,j->name);
+		pthread_mutex_lock(&w->lock);
+		jobDone(w,j);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/* finishes what the journal says was converted, then starts it afresh */
+static int watchRecover(struct watch* const w, const unsigned dir) {
+	char path[PATH_MAX], line[NAME_MAX+64];
+	FILE* f;
+
+	snprintf(path,sizeof(path),"%s/" WATCH_JOURNAL,w->dirs[dir]);
+	if ((f = fopen(path,"r"))) {
+		while (fgets(line,sizeof(line),f)) {
+			char file[PATH_MAX], status[8];
+			long long size, mtime;
+			struct stat st;
+			int off;
+
+			line[strcspn(line,"\n")] = '\0';
+			if (sscanf(line,"%lld %lld %7s %n",&size,&mtime,status,&off) != 3) {
+				continue;
+			}
+			snprintf(file,sizeof(file),"%s/%s",w->dirs[dir],line+off);
+			if (!stat(file,&st) && st.st_size == size && st.st_mtime == mtime) {
+				watchMove(w,dir,line+off,!strcmp(status,"done"));
+			}
+		}
+		fclose(f);
+	}
+	w->journal[dir] = open(path,O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC,0644);
+	if (w->journal[dir] < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+int watchDirs(char* const dirs[], const unsigned ndirs, const struct outspec outs[],
+	      const unsigned nouts, const struct gr260_export* tmpl, unsigned nworkers) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct watch w = { .dirs = dirs, .outs = outs, .nouts = nouts, .tmpl = tmpl };
+	int* const wd = calloc(ndirs,sizeof(int));
+	pthread_t* th;
+	unsigned i;
+	int in, rc = 0;
+
+	if (!nworkers) {
+		const long n = sysconf(_SC_NPROCESSORS_ONLN);
+		nworkers = n > 0 ? n : 1;
+	}
+	for (i = 0; i < nouts; i++) {
+		const int shared = watchShared(&outs[i]);
+
+		if (shared < 0) {
+			fprintf(stderr,"-o %s:%s would be overwritten by every dump,"
+				" put %%s in it\n",outs[i].fmt,outs[i].path);
+			free(wd);
+			return -1;
+		}
+		w.shared |= shared;
+	}
+	pthread_mutex_init(&w.lock,NULL);
+	pthread_mutex_init(&w.sharedlock,NULL);
+	pthread_cond_init(&w.cond,NULL);
+	w.journal = calloc(ndirs,sizeof(int));
+	in = inotify_init1(IN_CLOEXEC);
+	if (in < 0) {
+		perror("inotify_init1");
+		return -1;
+	}
+	for (i = 0; i < ndirs; i++) {
+		char sub[PATH_MAX];
+
+		snprintf(sub,sizeof(sub),"%s/done",dirs[i]);
+		if (mkdir(sub,0755) < 0 && errno != EEXIST) {
+			perror(sub);
+			return -1;
+		}
+		snprintf(sub,sizeof(sub),"%s/failed",dirs[i]);
+		if (mkdir(sub,0755) < 0 && errno != EEXIST) {
+			perror(sub);
+			return -1;
+		}
+		/* watched before the scan, so nothing dropped in between is missed */
+		wd[i] = inotify_add_watch(in,dirs[i],IN_CLOSE_WRITE|IN_MOVED_TO|IN_ONLYDIR);
+		if (wd[i] < 0) {
+			perror(dirs[i]);
+			return -1;
+		}
+		if (watchRecover(&w,i) < 0) {
+			return -1;
+		}
+		watchScan(&w,i);
+	}
+	th = calloc(nworkers,sizeof(pthread_t));
+	for (i = 0; i < nworkers; i++) {
+		if ((errno = pthread_create(&th[i],NULL,watchWorker,&w))) {
+			perror("pthread_create");
+			nworkers = i;
+			gWatchQuit = 1;
+			rc = -1;
+			break;
+		}
+	}
+	signal(SIGINT,watchQuit);
+	signal(SIGTERM,watchQuit);
+	fprintf(stderr,"watching %u director%s with %u workers\n",ndirs,
+		ndirs > 1 ? "ies" : "y",nworkers);
+	while (!gWatchQuit) {
+		struct pollfd pfd = { .fd = in, .events = POLLIN };
+		ssize_t n;
+		char* p;
+
+		if (poll(&pfd,1,-1) <= 0 || (n = read(in,buf,sizeof(buf))) <= 0) {
+			continue; /* EINTR, gWatchQuit is set */
+		}
+		for (p = buf; p < buf+n; p += sizeof(struct inotify_event)+((struct inotify_event*)p)->len) {
+			const struct inotify_event* const ev = (const struct inotify_event*)p;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				for (i = 0; i < ndirs; i++)
+					watchScan(&w,i);
+				continue;
+			}
+			for (i = 0; i < ndirs && wd[i] != ev->wd; i++)
+				;
+			if (i < ndirs && ev->len && !(ev->mask & IN_ISDIR)) {
+				pthread_mutex_lock(&w.lock);
+				jobAdd(&w,i,ev->name);
+				pthread_mutex_unlock(&w.lock);
+			}
+		}
+	}
+	fprintf(stderr,"\nfinishing the dumps in progress\n");
+	pthread_mutex_lock(&w.lock);
+	w.quit = 1;
+	pthread_cond_broadcast(&w.cond);
+	pthread_mutex_unlock(&w.lock);
+	for (i = 0; i < nworkers; i++) {
+		pthread_join(th[i],NULL);
+	}
+	while (w.jobs) {
+		struct job* const j = w.jobs;
+		w.jobs = j->next;
+		free(j);
+	}
+	for (i = 0; i < ndirs; i++) {
+		close(w.journal[i]);
+	}
+	close(in);
+	free(th);
+	free(wd);
+	free(w.journal);
+	return rc;
+}